@@ -0,0 +1,70 @@
+#ifndef __C_ALLOCATOR_ATOMIC_H__
+#define __C_ALLOCATOR_ATOMIC_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#ifdef CC_COMPILER_MSVC
+#    include <intrin.h>
+#endif
+
+// Internal, minimal set of atomic operations and a spin lock used by the allocators
+// that need to be shared between threads. Not part of the public interface.
+namespace ncore
+{
+    namespace natomic
+    {
+#ifdef CC_COMPILER_MSVC
+        inline s32   load(s32 volatile* p) { return _InterlockedOr((long volatile*)p, 0); }
+        inline void  store(s32 volatile* p, s32 v) { _InterlockedExchange((long volatile*)p, v); }
+        inline s32   exchange(s32 volatile* p, s32 v) { return _InterlockedExchange((long volatile*)p, v); }
+        inline s32   fetch_add(s32 volatile* p, s32 v) { return _InterlockedExchangeAdd((long volatile*)p, v); }
+        inline u32   load_relaxed(u32 const volatile* p) { return *p; }
+        inline u64   load_relaxed(u64 const volatile* p) { return *p; }
+        inline void* load_ptr(void* volatile* p) { return _InterlockedCompareExchangePointer(p, nullptr, nullptr); }
+        inline void* exchange_ptr(void* volatile* p, void* v) { return _InterlockedExchangePointer(p, v); }
+        inline bool  cas_ptr(void* volatile* p, void* expected, void* desired) { return _InterlockedCompareExchangePointer(p, desired, expected) == expected; }
+        inline void  pause() { _mm_pause(); }
+#else
+        inline s32   load(s32 volatile* p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+        inline void  store(s32 volatile* p, s32 v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+        inline s32   exchange(s32 volatile* p, s32 v) { return __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL); }
+        inline s32   fetch_add(s32 volatile* p, s32 v) { return __atomic_fetch_add(p, v, __ATOMIC_ACQ_REL); }
+        inline u32   load_relaxed(u32 const volatile* p) { return __atomic_load_n(p, __ATOMIC_RELAXED); }
+        inline u64   load_relaxed(u64 const volatile* p) { return __atomic_load_n(p, __ATOMIC_RELAXED); }
+        inline void* load_ptr(void* volatile* p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+        inline void* exchange_ptr(void* volatile* p, void* v) { return __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL); }
+        inline bool  cas_ptr(void* volatile* p, void* expected, void* desired) { return __atomic_compare_exchange_n(p, &expected, desired, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED); }
+#    if defined(__x86_64__) || defined(__i386__)
+        inline void pause() { __builtin_ia32_pause(); }
+#    elif defined(__aarch64__) || defined(__arm__)
+        inline void pause() { __asm__ __volatile__("yield"); }
+#    else
+        inline void pause() {}
+#    endif
+#endif
+
+        // Test-and-test-and-set spin lock, 0 = unlocked, 1 = locked
+        inline bool try_lock(s32 volatile* lock) { return load(lock) == 0 && exchange(lock, 1) == 0; }
+        inline void lock(s32 volatile* lock)
+        {
+            while (exchange(lock, 1) != 0)
+            {
+                while (load(lock) != 0)
+                    pause();
+            }
+        }
+        inline void unlock(s32 volatile* lock) { store(lock, 0); }
+
+        // A unique address per thread, used to identify the thread that owns a resource
+        inline void* thread_tag()
+        {
+            static thread_local u8 s_tag;
+            return &s_tag;
+        }
+
+    } // namespace natomic
+} // namespace ncore
+
+#endif // __C_ALLOCATOR_ATOMIC_H__
@@ -5,6 +5,7 @@
 #include "ccore/c_arena.h"
 
 #include "callocator/c_allocator_frame.h"
+#include "c_allocator_vmem.h"
 
 namespace ncore
 {
@@ -15,7 +16,7 @@ namespace ncore
     // the maximum number of active frames, the first arena 'should' be unoccupied, so we can reuse it.
     // An ASSERT will be triggered if we switch lanes and the target lane is still occupied.
 
-    frame_allocator_t::frame_allocator_t() : m_active_lane(0), m_max_active_frames(0), m_current_frame(nullptr)
+    frame_allocator_t::frame_allocator_t() : m_active_lane(0), m_max_active_frames(0), m_current_frame(nullptr), m_reserved(0), m_huge_pages(false)
     {
         for (s32 i = 0; i < 2; i++)
         {
@@ -45,13 +46,20 @@ namespace ncore
         m_current_frame = nullptr;
     }
 
-    void frame_allocator_t::setup(s32 max_active_frames, int_t average_frame_size, int_t max_reserved_size)
+    void frame_allocator_t::setup(s32 max_active_frames, int_t average_frame_size, int_t max_reserved_size, bool huge_pages)
     {
+        if (huge_pages)
+            max_reserved_size = nvmem::huge_page_align(max_reserved_size) + nvmem::HUGE_PAGE_SIZE; // room to align the memory
+
         m_max_active_frames = max_active_frames;
+        m_reserved          = (sizeof(frame_t) * max_active_frames) + sizeof(arena_t) + max_reserved_size;
+        m_huge_pages        = huge_pages;
         for (s32 i = 0; i < 2; i++)
         {
-            arena_t* arena   = narena::new_arena((sizeof(frame_t) * max_active_frames) + sizeof(arena_t) + max_reserved_size, (sizeof(frame_t) * max_active_frames) + average_frame_size * max_active_frames);
+            arena_t* arena   = narena::new_arena(m_reserved, (sizeof(frame_t) * max_active_frames) + average_frame_size * max_active_frames);
             m_frames[i]      = (frame_t*)narena::alloc_and_zero(arena, sizeof(frame_t) * max_active_frames);
+            if (huge_pages)
+                nvmem::arena_align_huge(arena, m_reserved);
             m_save_addresses[i] = narena::current_address(arena);
             m_arena[i]       = arena;
         }
@@ -89,6 +97,8 @@ namespace ncore
                 narena::reset(m_arena[new_lane]); // Reset the arena for the new lane
                 narena::alloc(m_arena[new_lane], sizeof(arena_t));
                 m_frames[new_lane] = (frame_t*)narena::alloc_and_zero(m_arena[new_lane], sizeof(frame_t) * m_max_active_frames);
+                if (m_huge_pages)
+                    nvmem::arena_align_huge(m_arena[new_lane], m_reserved);
             }
             else
             {
@@ -151,7 +161,7 @@ namespace ncore
     {
         ASSERT(m_current_frame != nullptr);
 
-        byte* p = (byte*)narena::alloc(m_arena[m_active_lane], (int_t)size, alignment);
+        byte* p = m_huge_pages ? (byte*)nvmem::arena_alloc_huge(m_arena[m_active_lane], (int_t)size, alignment) : (byte*)narena::alloc(m_arena[m_active_lane], (int_t)size, alignment);
 
 #ifdef TARGET_DEBUG
         nmem::memset(p, 0xcd, size);
@@ -6,628 +6,2330 @@
 #include "ccore/c_arena.h"
 
 #include "callocator/c_allocator_heap.h"
+#include "c_allocator_atomic.h"
+#include "c_allocator_vmem.h"
 
 #ifdef CC_COMPILER_MSVC
 #    include <intrin.h>
 #endif
 
+// Compact block headers, on 64-bit platforms define TLSF_COMPACT_HEADER to store the block
+// header and the block links as 32-bit values. The links are offsets relative to the block
+// itself (like the forward allocator's node_t), this halves the block overhead (4 bytes) and
+// the minimum block size (12 bytes) at the cost of a maximum block size of 2 GB and the
+// requirement that all blocks of a heap are near each other (see block_in_reach).
+#if CC_PLATFORM_PTR_SIZE == 8 && defined(TLSF_COMPACT_HEADER)
+#    define TLSF_COMPACT 1
+#else
+#    define TLSF_COMPACT 0
+#endif
+
+// Allocation categories (see g_heap_categories) keep the category of a block in the top byte of
+// its 64-bit header, block sizes never reach those bits.
+#if defined(HEAP_CATEGORIES) && (CC_PLATFORM_PTR_SIZE != 8 || TLSF_COMPACT)
+#    error "HEAP_CATEGORIES requires 64-bit block headers"
+#endif
+
 // A heap allocator implemented according to the TLSF allocator, Two-Level Segregate Fit
 namespace ncore
 {
-    namespace nheap
+    inline namespace HEAP_VARIANT
     {
-        enum ELevelCounts
+        namespace nheap
         {
-            TLSF_SL_COUNT = 16,
+            enum ELevelCounts
+            {
+                TLSF_SL_COUNT = 16,
+#if TLSF_COMPACT
+                TLSF_FL_COUNT = 26,
+                TLSF_FL_MAX   = 32,
+#elif CC_PLATFORM_PTR_SIZE == 8
+                TLSF_FL_COUNT = 32,
+                TLSF_FL_MAX   = 38,
+#else
+                TLSF_FL_COUNT = 25,
+                TLSF_FL_MAX   = 30,
+#endif
+            };
+
+#if TLSF_COMPACT
+            struct block_t // size in bytes = 4 + 4 + 4 + 4 = 16 bytes
+            {
+                // Links are relative to the block, in units of 4 bytes, 0 = null
+                s32 prev;      // Valid only if the previous block is free, stored at the end of the previous block.
+                u32 header;    // Size and block bits
+                s32 next_free; // Next and previous free blocks.
+                s32 prev_free; // Only valid if the corresponding block is free.
+            };
+
+            D_INLINE block_t* link_get(const block_t* block, s32 link) { return link ? (block_t*)((char*)block + (int_t)link * 4) : nullptr; }
+            D_INLINE s32      link_make(const block_t* block, const block_t* to)
+            {
+                const int_t link = to ? ((char*)to - (char*)block) / 4 : 0;
+                ASSERTS(link == (s32)link, "block out of reach of a compact link");
+                return (s32)link;
+            }
+#else
+            struct block_t // size in bytes = 8 + 8 + 8 + 8 = 32 bytes
+            {
+                // Valid only if the previous block is free and is actually
+                // stored at the end of the previous block.
+                block_t* prev;
+                u64      header;    // Size and block bits
+                block_t* next_free; // Next and previous free blocks.
+                block_t* prev_free; // Only valid if the corresponding block is free.
+            };
+
+            D_INLINE block_t* link_get(const block_t*, block_t* link) { return link; }
+            D_INLINE block_t* link_make(const block_t*, block_t* to) { return to; }
+#endif
+
+            D_INLINE block_t* block_get_prev(const block_t* block) { return link_get(block, block->prev); }
+            D_INLINE void     block_set_prev(block_t* block, block_t* prev) { block->prev = link_make(block, prev); }
+            D_INLINE block_t* free_get_next(const block_t* block) { return link_get(block, block->next_free); }
+            D_INLINE void     free_set_next(block_t* block, block_t* next) { block->next_free = link_make(block, next); }
+            D_INLINE block_t* free_get_prev(const block_t* block) { return link_get(block, block->prev_free); }
+            D_INLINE void     free_set_prev(block_t* block, block_t* prev) { block->prev_free = link_make(block, prev); }
+
+            struct context_t // size in bytes = 4 + (4) + 128 + 4096 + 8 = 4236
+            {
+                DCORE_CLASS_PLACEMENT_NEW_DELETE
+
+                block_t* block[TLSF_FL_COUNT][TLSF_SL_COUNT]; // 32 * 16 * 8 bytes = 4096 bytes, pointers to free blocks
+                u32      sl[TLSF_FL_COUNT];                   // 32 * 4 bytes = 128 bytes, second level indices
+                u64      size;                                // 8 bytes, total size of the managed memory region
+                u32      fl;                                  // 4 bytes, first level index
+            };
+
+#define TLSF_MAX_SIZE (((uint_t)1 << (TLSF_FL_MAX - 1)) - BLOCK_OVERHEAD)
+
+            static void* g_aalloc(heap_t* heap, context_t* t, uint_t, uint_t);
+            static void* g_malloc(heap_t* heap, context_t* t, uint_t size);
+            static void* g_realloc(heap_t* heap, context_t* t, void*, uint_t);
+            static void  g_free(heap_t* heap, context_t* t, void*);
+
+            static void g_setup(context_t* t)
+            {
+                t->fl   = 0;
+                t->size = 0;
+                for (u32 i = 0; i < TLSF_FL_COUNT; ++i)
+                {
+                    t->sl[i] = 0;
+                    for (u32 j = 0; j < TLSF_SL_COUNT; ++j)
+                        t->block[i][j] = nullptr;
+                }
+            }
+
+    // All allocation sizes and addresses are aligned.
 #if CC_PLATFORM_PTR_SIZE == 8
-            TLSF_FL_COUNT = 32,
-            TLSF_FL_MAX   = 38,
+#    define ALIGN_SHIFT 3
 #else
-            TLSF_FL_COUNT = 25,
-            TLSF_FL_MAX   = 30,
+#    define ALIGN_SHIFT 2
 #endif
-        };
+#define ALIGN_SIZE ((uint_t)1 << ALIGN_SHIFT)
+
+    // First level (FL) and second level (SL) counts
+#define SL_SHIFT 4
+#define SL_COUNT (1U << SL_SHIFT)
+#define FL_MAX TLSF_FL_MAX
+#define FL_SHIFT (SL_SHIFT + ALIGN_SHIFT)
+#define FL_COUNT (FL_MAX - FL_SHIFT + 1)
+
+    // Block status bits are stored in the least significant bits (LSB) of the size field.
+#define BLOCK_BIT_FREE ((uint_t)1)
+#define BLOCK_BIT_PREV_FREE ((uint_t)2)
+#define BLOCK_BITS (BLOCK_BIT_FREE | BLOCK_BIT_PREV_FREE)
+
+    // The category of a used block is stored in the most significant byte of the header.
+#ifdef HEAP_CATEGORIES
+#    define BLOCK_CATEGORY_SHIFT 56
+#    define BLOCK_CATEGORY_MASK ((uint_t)0xFF << BLOCK_CATEGORY_SHIFT)
+#else
+#    define BLOCK_CATEGORY_MASK ((uint_t)0)
+#endif
+
+    // A free block must be large enough to store its header minus the size of the* prev field.
+    // With compact headers block sizes are 4 less than a multiple of ALIGN_SIZE (the bias), so that
+    // the payload of the next block, which starts 8 bytes after the end of the block, is aligned.
+#if TLSF_COMPACT
+#    define BLOCK_OVERHEAD (sizeof(u32))
+#    define BLOCK_SIZE_BIAS BLOCK_OVERHEAD
+#    define BLOCK_FIRST_PAD BLOCK_OVERHEAD
+#else
+#    define BLOCK_OVERHEAD (sizeof(uint_t))
+#    define BLOCK_SIZE_BIAS 0
+#    define BLOCK_FIRST_PAD 0
+#endif
+#define BLOCK_SIZE_MIN (sizeof(block_t) - sizeof(((block_t*)0)->prev))
+#define BLOCK_SIZE_MAX ((uint_t)1 << (FL_MAX - 1))
+#define BLOCK_SIZE_SMALL ((uint_t)1 << FL_SHIFT)
+
+            STATIC_ASSERTS(sizeof(uint_t) == 4 || sizeof(uint_t) == 8, "uint_t must be 32 or 64 bit");
+            STATIC_ASSERTS(sizeof(uint_t) == sizeof(void*), "uint_t must equal pointer size");
+            STATIC_ASSERTS(ALIGN_SIZE == BLOCK_SIZE_SMALL / SL_COUNT, "sizes are not properly set");
+            STATIC_ASSERTS(BLOCK_SIZE_MIN < BLOCK_SIZE_SMALL, "min allocation size is wrong");
+            STATIC_ASSERTS(BLOCK_SIZE_MAX == TLSF_MAX_SIZE + BLOCK_OVERHEAD, "max allocation size is wrong");
+            STATIC_ASSERTS(FL_COUNT <= 32, "index too large");
+            STATIC_ASSERTS(SL_COUNT <= 32, "index too large");
+            STATIC_ASSERTS(FL_COUNT == TLSF_FL_COUNT, "invalid level configuration");
+            STATIC_ASSERTS(SL_COUNT == TLSF_SL_COUNT, "invalid level configuration");
+
+            static D_INLINE u32 bitmap_ffs(u32 x) { return (u32)math::findFirstBit(x); }
+            static D_INLINE s8  log2floor(uint_t x) { return math::ilog2(x); }
+
+            D_INLINE bool   block_size_valid(uint_t size) { return !((size + BLOCK_SIZE_BIAS) % ALIGN_SIZE); }
+            D_INLINE uint_t block_size(const block_t* block) { return block->header & ~(BLOCK_BITS | BLOCK_CATEGORY_MASK); }
+            D_INLINE void   block_set_size(block_t* block, uint_t size)
+            {
+                ASSERTS(block_size_valid(size), "invalid size");
+                block->header = (block->header & (BLOCK_BITS | BLOCK_CATEGORY_MASK)) | size;
+            }
+
+            D_INLINE bool block_is_free(const block_t* block) { return !!(block->header & BLOCK_BIT_FREE); }
+            D_INLINE bool block_is_prev_free(const block_t* block) { return !!(block->header & BLOCK_BIT_PREV_FREE); }
+            D_INLINE void block_set_prev_free(block_t* block, bool free) { block->header = free ? block->header | BLOCK_BIT_PREV_FREE : block->header & ~BLOCK_BIT_PREV_FREE; }
+
+            D_INLINE uint_t align_up(uint_t x, uint_t align)
+            {
+                ASSERTS(!(align & (align - 1)), "must align to a power of two");
+                return (((x - 1) | (align - 1)) + 1);
+            }
+
+            D_INLINE char*    align_ptr(char* p, uint_t align) { return (char*)align_up((uint_t)p, align); }
+            D_INLINE char*    block_payload(block_t* block) { return (char*)block + CC_OFFSETOF(block_t, header) + BLOCK_OVERHEAD; }
+            D_INLINE block_t* to_block(void* ptr)
+            {
+                block_t* block = (block_t*)ptr;
+                ASSERTS(block_payload(block) == align_ptr(block_payload(block), ALIGN_SIZE), "block not aligned properly");
+                return block;
+            }
+
+            D_INLINE block_t* block_from_payload(void* ptr) { return to_block((char*)ptr - CC_OFFSETOF(block_t, header) - BLOCK_OVERHEAD); }
+
+            // Return location of previous block.
+            D_INLINE block_t* block_prev(const block_t* block)
+            {
+                ASSERTS(block_is_prev_free(block), "previous block must be free");
+                return block_get_prev(block);
+            }
+
+            // Return location of next existing block.
+            D_INLINE block_t* block_next(block_t* block)
+            {
+                block_t* next = to_block(block_payload(block) + block_size(block) - BLOCK_OVERHEAD);
+                ASSERTS(block_size(block), "block is last");
+                return next;
+            }
+
+            // Link a new block with its neighbor, return the neighbor.
+            D_INLINE block_t* block_link_next(block_t* block)
+            {
+                block_t* next = block_next(block);
+                block_set_prev(next, block);
+                return next;
+            }
+
+            D_INLINE bool block_can_split(block_t* block, uint_t size) { return block_size(block) >= sizeof(block_t) + size; }
+            D_INLINE void block_set_free(block_t* block, bool free)
+            {
+                ASSERTS(block_is_free(block) != free, "block free bit unchanged");
+                block->header = free ? block->header | BLOCK_BIT_FREE : block->header & ~BLOCK_BIT_FREE;
+                block_set_prev_free(block_link_next(block), free);
+            }
+
+            // Adjust allocation size to be aligned, and no smaller than internal minimum.
+            D_INLINE uint_t adjust_size(uint_t size, uint_t align)
+            {
+                size = align_up(size + BLOCK_SIZE_BIAS, align) - BLOCK_SIZE_BIAS;
+                return size < BLOCK_SIZE_MIN ? BLOCK_SIZE_MIN : size;
+            }
+
+            // Round up to the next block size
+            D_INLINE uint_t round_block_size(uint_t size)
+            {
+                ASSERTS(size >= (1 << SL_SHIFT), "size must be greater than (1<<SL_SHIFT)");
+                uint_t t = ((uint_t)1 << (log2floor(size) - SL_SHIFT)) - 1;
+                return size >= BLOCK_SIZE_SMALL ? (size + t) & ~t : size;
+            }
+
+            D_INLINE void mapping(uint_t size, u32* fl, u32* sl)
+            {
+                if (size < BLOCK_SIZE_SMALL)
+                {
+                    // Store small blocks in first list.
+                    *fl = 0;
+                    *sl = (u32)size / (BLOCK_SIZE_SMALL / SL_COUNT);
+                }
+                else
+                {
+                    u32 t = log2floor(size);
+                    *sl   = (u32)(size >> (t - SL_SHIFT)) ^ SL_COUNT;
+                    *fl   = t - FL_SHIFT + 1;
+                }
+                ASSERTS(*fl < FL_COUNT, "wrong first level");
+                ASSERTS(*sl < SL_COUNT, "wrong second level");
+            }
+
+            D_INLINE block_t* block_find_suitable(context_t* t, u32* fl, u32* sl)
+            {
+                ASSERTS(*fl < FL_COUNT, "wrong first level");
+                ASSERTS(*sl < SL_COUNT, "wrong second level");
+
+                /* Search for a block in the list associated with the given fl/sl index. */
+                u32 sl_map = t->sl[*fl] & (~0U << *sl);
+                if (!sl_map)
+                {
+                    // No block exists. Search in the next largest first-level list.
+                    u32 fl_map = t->fl & (u32)(~(u64)0 << (*fl + 1));
+
+                    // No free blocks available, memory has been exhausted.
+                    if (CC_UNLIKELY(!fl_map))
+                        return NULL;
+
+                    *fl = bitmap_ffs(fl_map);
+                    ASSERTS(*fl < FL_COUNT, "wrong first level");
+
+                    sl_map = t->sl[*fl];
+                    ASSERTS(sl_map, "second level bitmap is null");
+                }
+
+                *sl = bitmap_ffs(sl_map);
+                ASSERTS(*sl < SL_COUNT, "wrong second level");
+
+                return t->block[*fl][*sl];
+            }
+
+            // Remove a free block from the free list.
+            D_INLINE void remove_free_block(context_t* t, block_t* block, u32 fl, u32 sl)
+            {
+                ASSERTS(fl < FL_COUNT, "wrong first level");
+                ASSERTS(sl < SL_COUNT, "wrong second level");
+
+                block_t* prev = free_get_prev(block);
+                block_t* next = free_get_next(block);
+                if (next)
+                    free_set_prev(next, prev);
+                if (prev)
+                    free_set_next(prev, next);
+
+                // If this block is the head of the free list, set new head.
+                if (t->block[fl][sl] == block)
+                {
+                    t->block[fl][sl] = next;
+
+                    // If the new head is null, clear the bitmap.
+                    if (!next)
+                    {
+                        t->sl[fl] &= ~(1U << sl);
+
+                        // If the second bitmap is now empty, clear the fl bitmap.
+                        if (!t->sl[fl])
+                            t->fl &= ~(1U << fl);
+                    }
+                }
+            }
+
+            // Insert a free block into the free block list and mark the bitmaps.
+            D_INLINE void insert_free_block(context_t* t, block_t* block, u32 fl, u32 sl)
+            {
+                block_t* current = t->block[fl][sl];
+                ASSERTS(block, "cannot insert a null entry into the free list");
+                free_set_next(block, current);
+                free_set_prev(block, nullptr);
+                if (current)
+                    free_set_prev(current, block);
+                t->block[fl][sl] = block;
+                t->fl |= 1U << fl;
+                t->sl[fl] |= 1U << sl;
+            }
+
+            // Remove a given block from the free list.
+            D_INLINE void block_remove(context_t* t, block_t* block)
+            {
+                u32 fl, sl;
+                mapping(block_size(block), &fl, &sl);
+                remove_free_block(t, block, fl, sl);
+            }
+
+            // A free block keeps a purged mark in the word behind its free list links, see g_purge. A block
+            // that is inserted (freed, merged or split off) has pages that were touched, its mark is cleared.
+            D_INLINE u32* block_purge_mark(block_t* block) { return (u32*)(block_payload(block) + sizeof(block_t) - CC_OFFSETOF(block_t, next_free)); }
+
+            // Insert a given block into the free list.
+            D_INLINE void block_insert(context_t* t, block_t* block)
+            {
+                u32 fl, sl;
+                mapping(block_size(block), &fl, &sl);
+                insert_free_block(t, block, fl, sl);
+                if (block_size(block) >= sizeof(block_t) + sizeof(u32))
+                    *block_purge_mark(block) = 0;
+            }
+
+            // Split a block into two, the second of which is free.
+            D_INLINE block_t* block_split(block_t* block, uint_t size)
+            {
+                block_t* rest      = to_block(block_payload(block) + size - BLOCK_OVERHEAD);
+                uint_t   rest_size = block_size(block) - (size + BLOCK_OVERHEAD);
+                ASSERTS(block_size(block) == rest_size + size + BLOCK_OVERHEAD, "rest block size is wrong");
+                ASSERTS(rest_size >= BLOCK_SIZE_MIN, "block split with invalid size");
+                rest->header = rest_size;
+                ASSERTS(block_size_valid(rest_size), "invalid block size");
+                block_set_free(rest, true);
+                block_set_size(block, size);
+                return rest;
+            }
+
+            // Absorb a free block's storage into an adjacent previous free block.
+            D_INLINE block_t* block_absorb(block_t* prev, block_t* block)
+            {
+                ASSERTS(block_size(prev), "previous block can't be last");
+                /* Note: Leaves flags untouched. */
+                prev->header += block_size(block) + BLOCK_OVERHEAD;
+                block_link_next(prev);
+                return prev;
+            }
+
+            // Merge a just-freed block with an adjacent previous free block.
+            D_INLINE block_t* block_merge_prev(context_t* t, block_t* block)
+            {
+                if (block_is_prev_free(block))
+                {
+                    block_t* prev = block_prev(block);
+                    ASSERTS(prev, "prev block can't be null");
+                    ASSERTS(block_is_free(prev), "prev block is not free though marked as such");
+                    block_remove(t, prev);
+                    block = block_absorb(prev, block);
+                }
+                return block;
+            }
+
+            // Merge a just-freed block with an adjacent free block.
+            D_INLINE block_t* block_merge_next(context_t* t, block_t* block)
+            {
+                block_t* next = block_next(block);
+                ASSERTS(next, "next block can't be null");
+                if (block_is_free(next))
+                {
+                    ASSERTS(block_size(block), "previous block can't be last");
+                    block_remove(t, next);
+                    block = block_absorb(block, next);
+                }
+                return block;
+            }
+
+            // Trim any trailing block space off the end of a block, return to pool.
+            D_INLINE void block_rtrim_free(context_t* t, block_t* block, uint_t size)
+            {
+                ASSERTS(block_is_free(block), "block must be free");
+                if (!block_can_split(block, size))
+                    return;
+                block_t* rest = block_split(block, size);
+                block_link_next(block);
+                block_set_prev_free(rest, true);
+                block_insert(t, rest);
+            }
+
+            // Trim any trailing block space off the end of a used block, return to pool.
+            D_INLINE void block_rtrim_used(context_t* t, block_t* block, uint_t size)
+            {
+                ASSERTS(!block_is_free(block), "block must be used");
+                if (!block_can_split(block, size))
+                    return;
+                block_t* rest = block_split(block, size);
+                block_set_prev_free(rest, false);
+                rest = block_merge_next(t, rest);
+                block_insert(t, rest);
+            }
+
+            D_INLINE block_t* block_ltrim_free(context_t* t, block_t* block, uint_t size)
+            {
+                ASSERTS(block_is_free(block), "block must be free");
+                ASSERTS(block_can_split(block, size), "block is too small");
+                block_t* rest = block_split(block, size - BLOCK_OVERHEAD);
+                block_set_prev_free(rest, true);
+                block_link_next(block);
+                block_insert(t, block);
+                return rest;
+            }
+
+            D_INLINE void* block_use(context_t* t, block_t* block, uint_t size)
+            {
+                block_rtrim_free(t, block, size);
+                block_set_free(block, false);
+                return block_payload(block);
+            }
+
+            D_INLINE void check_sentinel(block_t* block)
+            {
+                (void)block;
+                ASSERTS(!block_size(block), "sentinel should be last");
+                ASSERTS(!block_is_free(block), "sentinel block should not be free");
+            }
+
+            static bool arena_grow(heap_t* heap, context_t* t, uint_t size)
+            {
+                uint_t req_size = (t->size ? t->size + BLOCK_OVERHEAD : 2 * BLOCK_OVERHEAD + BLOCK_FIRST_PAD) + size;
+                void*  addr     = heap->m_resize_fn(heap, req_size);
+                if (!addr)
+                    return false;
+                ASSERTS((uint_t)addr % ALIGN_SIZE == 0, "wrong heap alignment address");
+                block_t* block = to_block(t->size ? (char*)addr + t->size - 2 * BLOCK_OVERHEAD : (char*)addr - BLOCK_OVERHEAD + BLOCK_FIRST_PAD);
+                if (!t->size)
+                    block->header = 0;
+                check_sentinel(block);
+                block->header |= size | BLOCK_BIT_FREE;
+                block = block_merge_prev(t, block);
+                block_insert(t, block);
+                block_t* sentinel = block_link_next(block);
+                sentinel->header  = BLOCK_BIT_PREV_FREE;
+                t->size           = req_size;
+                check_sentinel(sentinel);
+                return true;
+            }
+
+            static void arena_shrink(heap_t* heap, context_t* t, block_t* block)
+            {
+                check_sentinel(block_next(block));
+                uint_t size = block_size(block);
+                ASSERTS(t->size + BLOCK_OVERHEAD >= size, "invalid heap size before shrink");
+                t->size = t->size - size - BLOCK_OVERHEAD;
+                if (t->size == BLOCK_OVERHEAD + BLOCK_FIRST_PAD)
+                    t->size = 0;
+                heap->m_resize_fn(heap, t->size);
+                if (t->size)
+                {
+                    block->header = 0;
+                    check_sentinel(block);
+                }
+            }
+
+            // Pages, a page map holds 1 bit per 4 KB page of a heap region
+            enum EPage
+            {
+                PAGE_SHIFT = 12,
+                PAGE_SIZE  = 1 << PAGE_SHIFT,
+            };
+
+            struct page_map_t
+            {
+                u8*    m_bits;  // 1 bit per page
+                uint_t m_base;  // address of the first page covered by the page map
+                uint_t m_count; // number of pages covered by the page map
+            };
+
+            D_INLINE uint_t page_map_size(uint_t region_size) { return ((((region_size + PAGE_SIZE - 1) >> PAGE_SHIFT) + 1 + 63) >> 6) << 3; } // 8 byte multiple
+            D_INLINE bool   page_map_contains(page_map_t const* pm, void* ptr) { return (((uint_t)ptr - pm->m_base) >> PAGE_SHIFT) < pm->m_count; }
+            D_INLINE void   page_map_init(page_map_t* pm, u8* bits, void* region, uint_t region_size)
+            {
+                pm->m_bits  = bits;
+                pm->m_base  = (uint_t)region & ~((uint_t)PAGE_SIZE - 1);
+                pm->m_count = ((region_size + PAGE_SIZE - 1) >> PAGE_SHIFT) + 1;
+                nmem::memset(bits, 0, page_map_size(region_size));
+            }
+            D_INLINE bool page_map_test(page_map_t const* pm, void* ptr)
+            {
+                const uint_t page = ((uint_t)ptr - pm->m_base) >> PAGE_SHIFT;
+                return (pm->m_bits[page >> 3] & (1 << (page & 7))) != 0;
+            }
+            D_INLINE void page_map_set(page_map_t* pm, void* ptr, bool set)
+            {
+                const uint_t page = ((uint_t)ptr - pm->m_base) >> PAGE_SHIFT;
+                ASSERTS(page < pm->m_count, "address outside of the page map");
+                pm->m_bits[page >> 3] = set ? (u8)(pm->m_bits[page >> 3] | (1 << (page & 7))) : (u8)(pm->m_bits[page >> 3] & ~(1 << (page & 7)));
+            }
+
+            // Pools, besides the main region that grows with the arena a heap can manage additional
+            // non-contiguous regions. Each pool is a single block terminated by its own sentinel, a pool
+            // is either caller supplied memory or an arena that the heap created when the main region
+            // ran out of its reservation. Arena pools are given back as soon as they are completely free.
+            enum EPool
+            {
+                POOL_SIZE_MIN    = 1024 * 1024, // minimum size of a pool created by the heap
+                POOL_GRANULARITY = 64 * 1024,   // pools created by the heap are a multiple of this size
+            };
+
+            struct pool_t
+            {
+                pool_t*    m_next;
+                pool_t*    m_prev;
+                arena_t*   m_arena; // nullptr when the memory was supplied by the caller
+                char*      m_base;  // start of the region that holds the blocks
+                uint_t     m_size;  // size of the region
+                page_map_t m_pages; // page map of the region, set = page is a slab
+            };
+
+            D_INLINE block_t* pool_first_block(pool_t* pool) { return to_block(pool->m_base - BLOCK_OVERHEAD + BLOCK_FIRST_PAD); }
+
+            // The sentinel at the end of the main region, all other sentinels belong to a pool
+            D_INLINE bool block_is_heap_tail(heap_t* heap, context_t* t, block_t* sentinel) { return t->size && (char*)sentinel == (char*)heap->m_save_point + t->size - 2 * BLOCK_OVERHEAD; }
+
+            // Compact links reach +/- 8 GB, the main region is limited to 4 GB and pools must lie
+            // within 1 GB of the main region, so any two blocks of a heap can be linked.
+            static bool block_in_reach(heap_t* heap, void* mem, uint_t size)
+            {
+#if TLSF_COMPACT
+                const uint_t reach = (uint_t)1 << 30;
+                const uint_t begin = (uint_t)heap->m_save_point;
+                const uint_t end   = begin + ((uint_t)1 << 32);
+                return (uint_t)mem + reach >= begin && (uint_t)mem + size <= end + reach;
+#else
+                (void)heap;
+                (void)mem;
+                (void)size;
+                return true;
+#endif
+            }
+
+            // Initialize 'mem' as a pool, it holds the pool header, the page map and the region
+            static pool_t* pool_setup(heap_t* heap, context_t* t, arena_t* arena, void* mem, uint_t size)
+            {
+                pool_t* pool      = (pool_t*)align_ptr((char*)mem, ALIGN_SIZE);
+                char*   bits      = (char*)pool + align_up(sizeof(pool_t), ALIGN_SIZE);
+                uint_t  bits_size = page_map_size(size);
+                char*   region    = align_ptr(bits + bits_size + BLOCK_OVERHEAD, ALIGN_SIZE);
+                if ((char*)mem + size < region + BLOCK_SIZE_MIN + 2 * BLOCK_OVERHEAD + BLOCK_FIRST_PAD || !block_in_reach(heap, mem, size))
+                    return nullptr;
+
+                uint_t region_size = (uint_t)((char*)mem + size - region) & ~(ALIGN_SIZE - 1);
+                if (region_size - 2 * BLOCK_OVERHEAD - BLOCK_FIRST_PAD > TLSF_MAX_SIZE)
+                    region_size = align_up(TLSF_MAX_SIZE, ALIGN_SIZE);
+
+                pool->m_arena = arena;
+                pool->m_base  = region;
+                pool->m_size  = region_size;
+                page_map_init(&pool->m_pages, (u8*)bits, region, region_size);
+
+                // One free block that spans the region, its 'prev' field lies before the region and is never
+                // used since the previous block is never free, followed by a used sentinel of size 0.
+                block_t* block = pool_first_block(pool);
+                block->header  = (region_size - 2 * BLOCK_OVERHEAD - BLOCK_FIRST_PAD) | BLOCK_BIT_FREE;
+                block_insert(t, block);
+                block_t* sentinel = block_link_next(block);
+                sentinel->header  = BLOCK_BIT_PREV_FREE;
+                check_sentinel(sentinel);
+
+                pool->m_prev = nullptr;
+                pool->m_next = heap->m_pools;
+                if (pool->m_next)
+                    pool->m_next->m_prev = pool;
+                heap->m_pools = pool;
+                return pool;
+            }
+
+            // The main region cannot grow anymore, add a pool that can hold a block of 'size'
+            static bool pool_grow(heap_t* heap, context_t* t, uint_t size)
+            {
+                uint_t pool_size = align_up(size + sizeof(pool_t) + page_map_size(size + POOL_GRANULARITY) + 4 * BLOCK_OVERHEAD, POOL_GRANULARITY);
+                if (pool_size < POOL_SIZE_MIN)
+                    pool_size = POOL_SIZE_MIN;
+
+                arena_t* arena = narena::new_arena((int_t)pool_size + PAGE_SIZE, (int_t)pool_size + PAGE_SIZE);
+                if (!arena)
+                    return false;
+                void* mem = narena::alloc(arena, (int_t)pool_size, PAGE_SIZE);
+                if (!mem || !pool_setup(heap, t, arena, mem, pool_size))
+                {
+                    narena::destroy(arena);
+                    return false;
+                }
+                return true;
+            }
+
+            static void pool_unlink(heap_t* heap, pool_t* pool)
+            {
+                if (pool->m_prev)
+                    pool->m_prev->m_next = pool->m_next;
+                else
+                    heap->m_pools = pool->m_next;
+                if (pool->m_next)
+                    pool->m_next->m_prev = pool->m_prev;
+            }
+
+            // A free block that ends at a pool sentinel, when it spans the whole pool and the pool was
+            // created by the heap the pool is destroyed, otherwise the block goes back to the free lists.
+            static void pool_free_tail(heap_t* heap, context_t* t, block_t* block)
+            {
+                if (!block_is_prev_free(block))
+                {
+                    for (pool_t* pool = heap->m_pools; pool; pool = pool->m_next)
+                    {
+                        if (pool->m_arena && pool_first_block(pool) == block)
+                        {
+                            pool_unlink(heap, pool);
+                            narena::destroy(pool->m_arena);
+                            return;
+                        }
+                    }
+                }
+                block_insert(t, block);
+            }
+
+            // Purge, give the physical pages that are spanned by free blocks back to the OS. Only
+            // whole pages between the purged mark behind the free list links at the start of a block and
+            // the 'prev' field of the next block at its end are purged, they are backed again when the
+            // block is used. Blocks that are still marked were purged before and are skipped.
+            static int_t g_purge(context_t* t)
+            {
+                int_t purged = 0;
+                for (u32 fl = 0; fl < FL_COUNT; ++fl)
+                {
+                    if (!(t->fl & (1U << fl)))
+                        continue;
+                    for (u32 sl = 0; sl < SL_COUNT; ++sl)
+                    {
+                        for (block_t* block = t->block[fl][sl]; block; block = free_get_next(block))
+                        {
+                            u32*  mark  = block_purge_mark(block);
+                            char* begin = align_ptr((char*)(mark + 1), PAGE_SIZE);
+                            char* end   = (char*)((uint_t)(block_payload(block) + block_size(block) - BLOCK_OVERHEAD) & ~((uint_t)PAGE_SIZE - 1));
+                            if (end > begin && *mark == 0 && nvmem::purge(begin, (int_t)(end - begin)))
+                            {
+                                purged += (int_t)(end - begin);
+                                *mark = 1;
+                            }
+                        }
+                    }
+                }
+                return purged;
+            }
+
+            // The smallest block of at least 'size' among the first 'scan' blocks of a bin
+            D_INLINE block_t* block_best_in_bin(block_t* block, uint_t size, u32 scan)
+            {
+                block_t* best = nullptr;
+                for (; block && scan; block = free_get_next(block), --scan)
+                {
+                    const uint_t bsize = block_size(block);
+                    if (bsize >= size && (!best || bsize < block_size(best)))
+                    {
+                        best = block;
+                        if (bsize == size)
+                            break;
+                    }
+                }
+                return best;
+            }
+
+            // Best-fit, the bin that 'size' maps to holds blocks that are smaller and larger than size,
+            // a block from that bin is the closest fit. Otherwise take the smallest block of the first
+            // bin that only holds blocks that are large enough. Returns null when neither has a block.
+            static block_t* block_find_best(context_t* t, uint_t size, u32 scan)
+            {
+                u32 fl, sl;
+                mapping(size, &fl, &sl);
+                block_t* block = block_best_in_bin(t->block[fl][sl], size, scan);
+                if (!block)
+                {
+                    mapping(round_block_size(size), &fl, &sl);
+                    block = block_find_suitable(t, &fl, &sl);
+                    if (!block)
+                        return nullptr;
+                    block = block_best_in_bin(block, size, scan);
+                    ASSERTS(block, "good-fit bin without a suitable block");
+                }
+                remove_free_block(t, block, fl, sl);
+                return block;
+            }
+
+            D_INLINE block_t* block_find_free(heap_t* heap, context_t* t, uint_t size)
+            {
+                if (CC_UNLIKELY(heap->m_fit_scan))
+                {
+                    block_t* best = block_find_best(t, size, heap->m_fit_scan);
+                    if (best)
+                        return best;
+                }
+
+                uint_t rounded = round_block_size(size);
+                u32    fl, sl;
+                mapping(rounded, &fl, &sl);
+                block_t* block = block_find_suitable(t, &fl, &sl);
+                if (CC_UNLIKELY(!block))
+                {
+                    rounded = adjust_size(rounded, ALIGN_SIZE);
+                    if (!arena_grow(heap, t, rounded) && !pool_grow(heap, t, rounded))
+                        return NULL;
+                    block = block_find_suitable(t, &fl, &sl);
+                    ASSERTS(block, "no block found");
+                }
+                ASSERTS(block_size(block) >= size, "insufficient block size");
+                remove_free_block(t, block, fl, sl);
+                return block;
+            }
+
+            void* g_malloc(heap_t* heap, context_t* t, uint_t size)
+            {
+                size = adjust_size(size, ALIGN_SIZE);
+                if (CC_UNLIKELY(size > TLSF_MAX_SIZE))
+                    return NULL;
+                block_t* block = block_find_free(heap, t, size);
+                if (CC_UNLIKELY(!block))
+                    return NULL;
+                return block_use(t, block, size);
+            }
+
+            void* g_aalloc(heap_t* heap, context_t* t, uint_t align, uint_t size)
+            {
+                uint_t adjust = adjust_size(size, ALIGN_SIZE);
+
+                // Note: unlike C11 aligned_alloc the size does not have to be a multiple of the alignment
+                if (CC_UNLIKELY(!size || (align & (align - 1)) /* align!=2**x */ || adjust > TLSF_MAX_SIZE - align - sizeof(block_t)))
+                    return NULL;
+
+                if (align <= ALIGN_SIZE)
+                    return g_malloc(heap, t, size);
+
+                uint_t   asize = adjust_size(adjust + align - 1 + sizeof(block_t), align);
+                block_t* block = block_find_free(heap, t, asize);
+                if (CC_UNLIKELY(!block))
+                    return NULL;
+
+                char* mem = align_ptr(block_payload(block) + sizeof(block_t), align);
+                block     = block_ltrim_free(t, block, (uint_t)(mem - block_payload(block)));
+                return block_use(t, block, adjust);
+            }
+
+            void g_free(heap_t* heap, context_t* t, void* mem)
+            {
+                if (CC_UNLIKELY(!mem))
+                    return;
+
+                block_t* block = block_from_payload(mem);
+                ASSERTS(!block_is_free(block), "block already marked as free");
+                heap->m_purge_dirty += (int_t)block_size(block);
+
+                block_set_free(block, true);
+                block = block_merge_prev(t, block);
+                block = block_merge_next(t, block);
+
+                block_t* next = block_next(block);
+                if (CC_LIKELY(block_size(next)))
+                    block_insert(t, block);
+                else if (block_is_heap_tail(heap, t, next))
+                    arena_shrink(heap, t, block);
+                else
+                    pool_free_tail(heap, t, block);
+            }
+
+            // Grow a used block in place to at least 'size' (already adjusted) by absorbing the next
+            // block when it is free, when the block is the last one the arena is grown first.
+            static bool g_expand(heap_t* heap, context_t* t, block_t* block, uint_t size)
+            {
+                ASSERTS(!block_is_free(block), "block already marked as free");
+                uint_t avail = block_size(block);
+                if (size <= avail)
+                    return true;
+
+                // The block, possibly followed by a free block, is the last one of the region
+                block_t* next = block_next(block);
+                block_t* last = block_is_free(next) ? block_next(next) : next;
+                uint_t   have = block_is_free(next) ? avail + block_size(next) + BLOCK_OVERHEAD : avail;
+                if (size > have && !block_size(last))
+                {
+                    // Last block of a pool, pools have a fixed size.
+                    if (!block_is_heap_tail(heap, t, last))
+                        return false;
+
+                    // Last block, grow the arena which will place (or extend) a free block right after us.
+                    if (!arena_grow(heap, t, adjust_size(size - have, ALIGN_SIZE)))
+                        return false;
+                    next = block_next(block);
+                }
+
+                // If the next block is used or too small we cannot expand in place.
+                if (!block_is_free(next) || size > avail + block_size(next) + BLOCK_OVERHEAD)
+                    return false;
+
+                block_merge_next(t, block);
+                block_set_prev_free(block_next(block), false);
+                return true;
+            }
+
+            static bool g_try_expand(heap_t* heap, context_t* t, void* mem, uint_t size)
+            {
+                size = adjust_size(size, ALIGN_SIZE);
+                if (CC_UNLIKELY(!mem || size > TLSF_MAX_SIZE))
+                    return false;
+
+                block_t* block = block_from_payload(mem);
+                if (!g_expand(heap, t, block, size))
+                    return false;
+
+                // Return what we absorbed beyond the requested size
+                block_rtrim_used(t, block, size);
+                return true;
+            }
+
+            static void g_shrink(context_t* t, void* mem, uint_t size)
+            {
+                if (CC_UNLIKELY(!mem))
+                    return;
+                block_t* block = block_from_payload(mem);
+                ASSERTS(!block_is_free(block), "block already marked as free");
+                block_rtrim_used(t, block, adjust_size(size, ALIGN_SIZE));
+            }
+
+            void* g_realloc(heap_t* heap, context_t* t, void* mem, uint_t size)
+            {
+                // Zero-size requests are treated as free.
+                if (CC_UNLIKELY(mem && !size))
+                {
+                    g_free(heap, t, mem);
+                    return NULL;
+                }
+
+                // Null-pointer requests are treated as malloc.
+                if (CC_UNLIKELY(!mem))
+                    return g_malloc(heap, t, size);
+
+                block_t* block = block_from_payload(mem);
+                uint_t   avail = block_size(block);
+                size           = adjust_size(size, ALIGN_SIZE);
+                if (CC_UNLIKELY(size > TLSF_MAX_SIZE))
+                    return NULL;
+
+                // Do we need to expand, and if so can we do it in place?
+                if (size > avail && !g_expand(heap, t, block, size))
+                {
+                    // We must relocate and copy.
+                    void* dst = g_malloc(heap, t, size);
+                    if (dst)
+                    {
+                        nmem::memcpy(dst, mem, avail);
+                        g_free(heap, t, mem);
+                    }
+                    return dst;
+                }
+
+                // Trim the resulting block and return the original pointer.
+                block_rtrim_used(t, block, size);
+                return mem;
+            }
+
+            // Slabs, small sizes (<= 128 bytes) are served from page sized slabs that are carved from
+            // the heap. A slab holds objects of one size-class and tracks them with a bitmap, so the
+            // objects carry no block header and allocation/free is a bitmap find/clear. A page map
+            // with one bit per page of the heap region tells if a pointer belongs to a slab.
+            enum ESlab
+            {
+                SLAB_SHIFT        = PAGE_SHIFT,                            // slab size is one 4 KB page
+                SLAB_SIZE         = 1 << SLAB_SHIFT,                       //
+#ifdef HEAP_CATEGORIES
+                SLAB_HEADER_SIZE  = 320,                                   // objects start after the slab header and the categories
+#else
+                SLAB_HEADER_SIZE  = 64,                                    // objects start after the slab header
+#endif
+                SLAB_CLASS_SHIFT  = 4,                                     // size-class granularity is 16 bytes
+                SLAB_CLASS_COUNT  = 8,                                     // size-classes 16, 32, 48 ... 128
+                SLAB_MAX_SIZE     = SLAB_CLASS_COUNT << SLAB_CLASS_SHIFT,  //
+                SLAB_ALIGN        = 1 << SLAB_CLASS_SHIFT,                 // objects are aligned to 16 bytes
+                SLAB_BITMAP_WORDS = 4,                                     // (4096 - 64) / 16 = 252 objects max
+            };
+
+            struct slab_t
+            {
+                slab_t* m_next;                    // list of slabs that have free objects
+                slab_t* m_prev;                    //
+                u16     m_class;                   // size-class index
+                u16     m_size;                    // object size in bytes
+                u16     m_used;                    // number of objects in use
+                u16     m_capacity;                // number of objects in this slab
+                u64     m_free[SLAB_BITMAP_WORDS]; // 1 bit per object, set = free
+#ifdef HEAP_CATEGORIES
+                u8 m_category[SLAB_BITMAP_WORDS * 64]; // category per object
+#endif
+            };
+            STATIC_ASSERTS(sizeof(slab_t) <= SLAB_HEADER_SIZE, "slab header too large");
+
+            struct slabs_t
+            {
+                slab_t*    m_partial[SLAB_CLASS_COUNT]; // per size-class, slabs that have at least one free object
+                page_map_t m_pages;                     // page map of the main heap region, set = page is a slab
+            };
+
+            // The page map of the region that holds ptr
+            D_INLINE page_map_t* page_map_of(heap_t* heap, void* ptr)
+            {
+                if (page_map_contains(&heap->m_slabs->m_pages, ptr))
+                    return &heap->m_slabs->m_pages;
+                for (pool_t* pool = heap->m_pools; pool; pool = pool->m_next)
+                {
+                    if (page_map_contains(&pool->m_pages, ptr))
+                        return &pool->m_pages;
+                }
+                return nullptr;
+            }
+
+            D_INLINE u32 slab_class(uint_t size) { return size == 0 ? 0 : (u32)((size - 1) >> SLAB_CLASS_SHIFT); }
+
+            D_INLINE slab_t* slab_of(heap_t* heap, void* ptr)
+            {
+                page_map_t* pm = page_map_of(heap, ptr);
+                if (!pm || !page_map_test(pm, ptr))
+                    return nullptr;
+                return (slab_t*)((uint_t)ptr & ~((uint_t)SLAB_SIZE - 1));
+            }
+
+            D_INLINE void slab_link(slabs_t* s, slab_t* slab)
+            {
+                slab->m_prev = nullptr;
+                slab->m_next = s->m_partial[slab->m_class];
+                if (slab->m_next)
+                    slab->m_next->m_prev = slab;
+                s->m_partial[slab->m_class] = slab;
+            }
+
+            D_INLINE void slab_unlink(slabs_t* s, slab_t* slab)
+            {
+                if (slab->m_prev)
+                    slab->m_prev->m_next = slab->m_next;
+                else
+                    s->m_partial[slab->m_class] = slab->m_next;
+                if (slab->m_next)
+                    slab->m_next->m_prev = slab->m_prev;
+            }
+
+            static slab_t* slab_create(heap_t* heap, context_t* t, u32 c)
+            {
+                slab_t* slab = (slab_t*)g_aalloc(heap, t, SLAB_SIZE, SLAB_SIZE);
+                if (CC_UNLIKELY(!slab))
+                    return nullptr;
+
+                page_map_t* pm = page_map_of(heap, slab);
+                ASSERTS(pm, "slab outside of the heap regions");
+                page_map_set(pm, slab, true);
+
+                slab->m_class    = (u16)c;
+                slab->m_size     = (u16)((c + 1) << SLAB_CLASS_SHIFT);
+                slab->m_used     = 0;
+                slab->m_capacity = (u16)((SLAB_SIZE - SLAB_HEADER_SIZE) / slab->m_size);
+                for (u32 w = 0; w < SLAB_BITMAP_WORDS; ++w)
+                {
+                    const u32 first = w * 64;
+                    const u32 count = slab->m_capacity > first ? slab->m_capacity - first : 0;
+                    slab->m_free[w] = count >= 64 ? ~(u64)0 : (((u64)1 << count) - 1);
+                }
+                slab_link(heap->m_slabs, slab);
+                return slab;
+            }
+
+            static void slab_release(heap_t* heap, context_t* t, slab_t* slab)
+            {
+                page_map_set(page_map_of(heap, slab), slab, false);
+                g_free(heap, t, slab);
+            }
+
+            D_INLINE void* slab_alloc(heap_t* heap, context_t* t, uint_t size)
+            {
+                const u32 c    = slab_class(size);
+                slab_t*   slab = heap->m_slabs->m_partial[c];
+                if (CC_UNLIKELY(!slab))
+                {
+                    slab = slab_create(heap, t, c);
+                    if (CC_UNLIKELY(!slab))
+                        return nullptr;
+                }
+
+                u32 w = 0;
+                while (slab->m_free[w] == 0)
+                    ++w;
+                ASSERTS(w < SLAB_BITMAP_WORDS, "slab on the partial list without a free object");
+                const u32 bit = (u32)math::findFirstBit(slab->m_free[w]);
+                slab->m_free[w] &= ~((u64)1 << bit);
+
+                if (++slab->m_used == slab->m_capacity)
+                    slab_unlink(heap->m_slabs, slab);
+
+                return (char*)slab + SLAB_HEADER_SIZE + (uint_t)(w * 64 + bit) * slab->m_size;
+            }
+
+            D_INLINE u32 slab_index(slab_t* slab, void* ptr) { return (u32)(((char*)ptr - ((char*)slab + SLAB_HEADER_SIZE)) / slab->m_size); }
+
+            D_INLINE void slab_free(heap_t* heap, context_t* t, slab_t* slab, void* ptr)
+            {
+                const u32 index = slab_index(slab, ptr);
+                ASSERTS(index < slab->m_capacity, "pointer is not an object of this slab");
+                ASSERTS(!(slab->m_free[index >> 6] & ((u64)1 << (index & 63))), "object already freed");
+                slab->m_free[index >> 6] |= (u64)1 << (index & 63);
+
+                if (slab->m_used-- == slab->m_capacity)
+                    slab_link(heap->m_slabs, slab);
+
+                // Give an empty slab back to the heap, unless it is the only one of its size-class
+                if (slab->m_used == 0 && (slab->m_prev || slab->m_next))
+                {
+                    slab_unlink(heap->m_slabs, slab);
+                    slab_release(heap, t, slab);
+                }
+            }
+
+            // Checkpoint, a snapshot of the heap that can be rolled back to, discarding everything that
+            // was allocated after it. At the checkpoint the free blocks and partial slabs are sealed,
+            // the context is emptied and allocations are served from the tail of the main region (and
+            // new pools) only. This leaves all memory that existed at the checkpoint untouched, so a
+            // rollback just restores the context, the commit level and the sentinel at the old tail.
+            // Freeing memory that was allocated before the checkpoint would touch sealed blocks, such
+            // frees are deferred until the rollback.
+            struct checkpoint_t
+            {
+                context_t m_context;                   // copy of the context at the checkpoint
+                slab_t*   m_partial[SLAB_CLASS_COUNT]; // partial slabs at the checkpoint
+                pool_t*   m_pools;                     // first pool that existed at the checkpoint
+                void*     m_huge_entries;              // huge table at the checkpoint
+                u32       m_huge_count;                //
+                u32       m_huge_capacity;             //
+                u64       m_sentinel;                  // header of the main sentinel at the checkpoint
+                void*     m_deferred;                  // allocations from before the checkpoint that were freed
+                bool      m_active;
+#ifdef HEAP_CATEGORIES
+                heap_category_t m_categories[HEAP_CATEGORY_COUNT]; // category counters at the checkpoint
+#endif
+            };
+
+            // Memory of the main region or of a pool that existed at the checkpoint
+            static bool checkpoint_sealed_region(heap_t* heap, void* ptr)
+            {
+                checkpoint_t* cp = heap->m_checkpoint;
+                if (!cp || !cp->m_active)
+                    return false;
+                if (ptr >= heap->m_save_point && (char*)ptr < (char*)heap->m_save_point + cp->m_context.size)
+                    return true;
+                for (pool_t* pool = cp->m_pools; pool; pool = pool->m_next)
+                {
+                    if ((char*)ptr >= pool->m_base && (char*)ptr < pool->m_base + pool->m_size)
+                        return true;
+                }
+                return false;
+            }
+
+            // Huge allocations, sizes at or above the threshold get their own virtual memory arena so
+            // they neither fragment the heap nor pin its committed size. A small table, that lives in
+            // the heap itself, tracks them so that a deallocation can recognize and release them.
+            enum EHuge
+            {
+                HUGE_THRESHOLD_DEFAULT = 4 * 1024 * 1024,
+                HUGE_TABLE_INITIAL     = 16,
+            };
+
+            struct huge_t
+            {
+                void*    m_ptr;
+                arena_t* m_arena;
+                uint_t   m_size;
+#ifdef HEAP_CATEGORIES
+                u8 m_category;
+#endif
+            };
+
+            struct huges_t
+            {
+                huge_t* m_entries;
+                u32     m_count;
+                u32     m_capacity;
+                uint_t  m_threshold;  // 0 = disabled
+                bool    m_huge_pages; // the heap was created with huge pages, so are the huge allocations
+            };
+
+            D_INLINE huge_t* huge_find(huges_t* h, void* ptr)
+            {
+                // Huge allocations are page aligned, which filters out most other pointers
+                if (h->m_count == 0 || ((uint_t)ptr & (PAGE_SIZE - 1)))
+                    return nullptr;
+                for (u32 i = 0; i < h->m_count; ++i)
+                {
+                    if (h->m_entries[i].m_ptr == ptr)
+                        return &h->m_entries[i];
+                }
+                return nullptr;
+            }
+
+            static void* huge_alloc(heap_t* heap, context_t* t, uint_t size)
+            {
+                huges_t* h = heap->m_huge;
+                if (h->m_count == h->m_capacity)
+                {
+                    const u32 capacity = h->m_capacity ? h->m_capacity * 2 : (u32)HUGE_TABLE_INITIAL;
+                    huge_t*   entries  = (huge_t*)g_malloc(heap, t, capacity * sizeof(huge_t));
+                    if (!entries)
+                        return nullptr;
+                    if (h->m_entries)
+                    {
+                        // A table from before the checkpoint is restored by a rollback, so it is kept
+                        nmem::memcpy(entries, h->m_entries, h->m_count * sizeof(huge_t));
+                        if (!checkpoint_sealed_region(heap, h->m_entries))
+                            g_free(heap, t, h->m_entries);
+                    }
+                    h->m_entries  = entries;
+                    h->m_capacity = capacity;
+                }
+
+                arena_t* arena;
+                uint_t   usable;
+                if (h->m_huge_pages)
+                {
+                    // Starts at a 2 MB boundary and is committed in whole huge pages, the reservation has
+                    // room for the arena (first page) and the alignment.
+                    usable               = (uint_t)nvmem::huge_page_align((int_t)size);
+                    const int_t reserved = (int_t)usable + 2 * (int_t)nvmem::HUGE_PAGE_SIZE;
+                    arena                = narena::new_arena(reserved, PAGE_SIZE);
+                    if (!arena)
+                        return nullptr;
+                    void* aligned = nvmem::arena_align_huge(arena, reserved);
+                    if (!narena::commit(arena, (int_t)((byte*)aligned - (byte*)narena::base(arena)) + (int_t)usable))
+                    {
+                        narena::destroy(arena);
+                        return nullptr;
+                    }
+                }
+                else
+                {
+                    usable             = align_up(size, PAGE_SIZE);    // the whole last page is usable
+                    const int_t commit = (int_t)usable + PAGE_SIZE;      // first page holds the arena
+                    arena              = narena::new_arena(commit, commit);
+                    if (!arena)
+                        return nullptr;
+                }
+                void* ptr = narena::alloc(arena, (int_t)size, PAGE_SIZE);
+                if (!ptr)
+                {
+                    narena::destroy(arena);
+                    return nullptr;
+                }
+
+                huge_t* e  = &h->m_entries[h->m_count++];
+                e->m_ptr   = ptr;
+                e->m_arena = arena;
+                e->m_size  = usable;
+                return ptr;
+            }
+
+            static void huge_free(heap_t* heap, huge_t* e)
+            {
+                huges_t* h = heap->m_huge;
+                narena::destroy(e->m_arena);
+                *e = h->m_entries[--h->m_count];
+            }
+
+            // Defer the free of an allocation from before the checkpoint, returns false otherwise
+            static bool checkpoint_defer(heap_t* heap, void* ptr)
+            {
+                checkpoint_t* cp = heap->m_checkpoint;
+                if (!checkpoint_sealed_region(heap, ptr))
+                {
+                    huge_t* huge = huge_find(heap->m_huge, ptr);
+                    if (!huge || (u32)(huge - heap->m_huge->m_entries) >= cp->m_huge_count)
+                        return false;
+                }
+                *(void**)ptr   = cp->m_deferred;
+                cp->m_deferred = ptr;
+                return true;
+            }
+
+            // Allocation and deallocation that dispatch between the slabs, the TLSF blocks and the
+            // huge allocations
+            D_INLINE bool is_huge(heap_t* heap, uint_t size) { return heap->m_huge->m_threshold && size >= heap->m_huge->m_threshold; }
+
+            D_INLINE void* heap_malloc(heap_t* heap, context_t* t, uint_t size)
+            {
+                if (size <= SLAB_MAX_SIZE)
+                    return slab_alloc(heap, t, size);
+                if (CC_UNLIKELY(is_huge(heap, size)))
+                    return huge_alloc(heap, t, size);
+                return g_malloc(heap, t, size);
+            }
+
+            D_INLINE void* heap_aalloc(heap_t* heap, context_t* t, uint_t align, uint_t size)
+            {
+                if (size <= SLAB_MAX_SIZE && align <= SLAB_ALIGN)
+                    return slab_alloc(heap, t, size);
+                if (CC_UNLIKELY(is_huge(heap, size) && align <= PAGE_SIZE))
+                    return huge_alloc(heap, t, size);
+                return g_aalloc(heap, t, align, size);
+            }
+
+            D_INLINE void heap_free(heap_t* heap, context_t* t, void* ptr)
+            {
+                if (CC_UNLIKELY(heap->m_checkpoint && heap->m_checkpoint->m_active) && checkpoint_defer(heap, ptr))
+                    return;
+                slab_t* slab = slab_of(heap, ptr);
+                if (slab)
+                {
+                    slab_free(heap, t, slab, ptr);
+                    return;
+                }
+                huge_t* huge = huge_find(heap->m_huge, ptr);
+                if (CC_UNLIKELY(huge))
+                    huge_free(heap, huge);
+                else
+                    g_free(heap, t, ptr);
+            }
+
+            static uint_t heap_usable_size(heap_t* heap, void* ptr)
+            {
+                slab_t* slab = slab_of(heap, ptr);
+                if (slab)
+                    return slab->m_size;
+                huge_t* huge = huge_find(heap->m_huge, ptr);
+                if (CC_UNLIKELY(huge))
+                    return huge->m_size;
+                return block_size(block_from_payload(ptr));
+            }
+
+            // The size that was requested tells whether a slab served it, a slab object is at most
+            // SLAB_MAX_SIZE, larger sizes skip the slab lookup. Aligned allocations of small sizes can be
+            // TLSF blocks, so those still check. The huge threshold can change after an allocation was
+            // made, so the size cannot rule out a huge allocation, the lookup is cheap since only page
+            // aligned pointers are searched.
+            D_INLINE void heap_free_sized(heap_t* heap, context_t* t, void* ptr, uint_t size)
+            {
+                ASSERTS(size <= heap_usable_size(heap, ptr), "size is larger than the allocation");
+                if (size <= SLAB_MAX_SIZE || CC_UNLIKELY(heap->m_checkpoint && heap->m_checkpoint->m_active))
+                {
+                    heap_free(heap, t, ptr);
+                    return;
+                }
+                huge_t* huge = huge_find(heap->m_huge, ptr);
+                if (CC_UNLIKELY(huge))
+                {
+                    huge_free(heap, huge);
+                    return;
+                }
+                ASSERTS(!slab_of(heap, ptr), "size does not match the allocation");
+                g_free(heap, t, ptr);
+            }
+
+            static void* heap_realloc(heap_t* heap, context_t* t, void* ptr, uint_t size)
+            {
+                // A new allocation, dispatched like one so that it can land in a slab or its own arena
+                if (!ptr)
+                    return size ? heap_malloc(heap, t, size) : nullptr;
+
+                if (CC_UNLIKELY(checkpoint_sealed_region(heap, ptr)))
+                {
+                    // Memory from before the checkpoint cannot be resized, it is moved instead
+                    void* dst = size ? heap_malloc(heap, t, size) : nullptr;
+                    if (dst)
+                    {
+                        const uint_t avail = heap_usable_size(heap, ptr);
+                        nmem::memcpy(dst, ptr, size < avail ? size : avail);
+                    }
+                    if (dst || !size)
+                        heap_free(heap, t, ptr);
+                    return dst;
+                }
 
-        struct block_t // size in bytes = 8 + 8 + 8 + 8 = 32 bytes
-        {
-            // Valid only if the previous block is free and is actually
-            // stored at the end of the previous block.
-            block_t* prev;
-            u64      header;    // Size and block bits
-            block_t* next_free; // Next and previous free blocks.
-            block_t* prev_free; // Only valid if the corresponding block is free.
-        };
+                huge_t* huge = huge_find(heap->m_huge, ptr);
+                if (CC_UNLIKELY(huge))
+                {
+                    if (size == 0)
+                    {
+                        huge_free(heap, huge);
+                        return nullptr;
+                    }
+                    if (size <= huge->m_size)
+                        return ptr;
 
-        struct context_t // size in bytes = 4 + (4) + 128 + 4096 + 8 = 4236
-        {
-            DCORE_CLASS_PLACEMENT_NEW_DELETE
+                    const uint_t old_size = huge->m_size;
+                    void*        dst      = heap_malloc(heap, t, size);
+                    if (dst)
+                    {
+                        nmem::memcpy(dst, ptr, old_size);
+                        heap_free(heap, t, ptr); // the table may have moved, look the entry up again
+                    }
+                    return dst;
+                }
 
-            block_t* block[TLSF_FL_COUNT][TLSF_SL_COUNT]; // 32 * 16 * 8 bytes = 4096 bytes, pointers to free blocks
-            u32      sl[TLSF_FL_COUNT];                   // 32 * 4 bytes = 128 bytes, second level indices
-            u64      size;                                // 8 bytes, total size of the managed memory region
-            u32      fl;                                  // 4 bytes, first level index
-        };
+                slab_t* slab = slab_of(heap, ptr);
+                if (!slab)
+                {
+                    // A block that grows beyond the huge threshold moves to its own arena
+                    const uint_t avail = block_size(block_from_payload(ptr));
+                    if (CC_UNLIKELY(size > avail && is_huge(heap, size)))
+                    {
+                        void* dst = huge_alloc(heap, t, size);
+                        if (dst)
+                        {
+                            nmem::memcpy(dst, ptr, avail);
+                            g_free(heap, t, ptr);
+                        }
+                        return dst;
+                    }
 
-#define TLSF_MAX_SIZE (((uint_t)1 << (TLSF_FL_MAX - 1)) - sizeof(uint_t))
+                    // Shrinking a block into a slab size-class keeps it where it is
+                    return g_realloc(heap, t, ptr, size);
+                }
 
-        static void* g_aalloc(heap_t* heap, context_t* t, uint_t, uint_t);
-        static void* g_malloc(heap_t* heap, context_t* t, uint_t size);
-        static void* g_realloc(heap_t* heap, context_t* t, void*, uint_t);
-        static void  g_free(heap_t* heap, context_t* t, void*);
+                if (size == 0)
+                {
+                    slab_free(heap, t, slab, ptr);
+                    return nullptr;
+                }
+                if (size <= slab->m_size)
+                    return ptr;
 
-        static void g_setup(context_t* t)
-        {
-            t->fl   = 0;
-            t->size = 0;
-            for (u32 i = 0; i < TLSF_FL_COUNT; ++i)
+                void* dst = heap_malloc(heap, t, size);
+                if (dst)
+                {
+                    nmem::memcpy(dst, ptr, slab->m_size);
+                    slab_free(heap, t, slab, ptr);
+                }
+                return dst;
+            }
+
+            // Categories, tracking sets the category of an allocation and adds it to the counters of
+            // that category, untracking removes it from the counters and returns the category. The
+            // dispatch functions do not track, the public functions do, so that an allocation that is
+            // moved by a reallocation is counted once.
+#ifdef HEAP_CATEGORIES
+            static void category_track(heap_t* heap, void* ptr, u8 category)
             {
-                t->sl[i] = 0;
-                for (u32 j = 0; j < TLSF_SL_COUNT; ++j)
-                    t->block[i][j] = nullptr;
+                uint_t  size;
+                slab_t* slab = slab_of(heap, ptr);
+                if (slab)
+                {
+                    slab->m_category[slab_index(slab, ptr)] = category;
+                    size                                    = slab->m_size;
+                }
+                else
+                {
+                    huge_t* huge = huge_find(heap->m_huge, ptr);
+                    if (CC_UNLIKELY(huge))
+                    {
+                        huge->m_category = category;
+                        size             = huge->m_size;
+                    }
+                    else
+                    {
+                        block_t* block = block_from_payload(ptr);
+                        block->header  = (block->header & ~BLOCK_CATEGORY_MASK) | ((uint_t)category << BLOCK_CATEGORY_SHIFT);
+                        size           = block_size(block);
+                    }
+                }
+                heap->m_categories[category].m_bytes += (int_t)size;
+                heap->m_categories[category].m_count += 1;
             }
-        }
 
-// All allocation sizes and addresses are aligned.
-#if CC_PLATFORM_PTR_SIZE == 8
-#    define ALIGN_SHIFT 3
+            static u8 category_untrack(heap_t* heap, void* ptr)
+            {
+                u8      category;
+                uint_t  size;
+                slab_t* slab = slab_of(heap, ptr);
+                if (slab)
+                {
+                    category = slab->m_category[slab_index(slab, ptr)];
+                    size     = slab->m_size;
+                }
+                else
+                {
+                    huge_t* huge = huge_find(heap->m_huge, ptr);
+                    if (CC_UNLIKELY(huge))
+                    {
+                        category = huge->m_category;
+                        size     = huge->m_size;
+                    }
+                    else
+                    {
+                        block_t* block = block_from_payload(ptr);
+                        category       = (u8)(block->header >> BLOCK_CATEGORY_SHIFT);
+                        size           = block_size(block);
+                    }
+                }
+                heap->m_categories[category].m_bytes -= (int_t)size;
+                heap->m_categories[category].m_count -= 1;
+                return category;
+            }
 #else
-#    define ALIGN_SHIFT 2
+            D_INLINE void category_track(heap_t*, void*, u8) {}
+            D_INLINE u8   category_untrack(heap_t*, void*) { return HEAP_CATEGORY_NONE; }
+
+            // Compiled out, categories cost no header bits, no bytes per slab object and no byte per huge allocation
+            STATIC_ASSERTS(BLOCK_CATEGORY_MASK == 0, "block headers carry a category");
+            STATIC_ASSERTS(SLAB_HEADER_SIZE == 64, "slabs reserve room for categories");
+            STATIC_ASSERTS(sizeof(huge_t) == sizeof(void*) + sizeof(arena_t*) + sizeof(uint_t), "huge allocations carry a category");
 #endif
-#define ALIGN_SIZE ((uint_t)1 << ALIGN_SHIFT)
 
-// First level (FL) and second level (SL) counts
-#define SL_SHIFT 4
-#define SL_COUNT (1U << SL_SHIFT)
-#define FL_MAX TLSF_FL_MAX
-#define FL_SHIFT (SL_SHIFT + ALIGN_SHIFT)
-#define FL_COUNT (FL_MAX - FL_SHIFT + 1)
+            // Remote free list, a lock-free multiple-producer single-consumer stack that is linked
+            // through the payload of the released blocks.
+            static void remote_push(heap_t* heap, void* ptr)
+            {
+                void* head;
+                do
+                {
+                    head         = natomic::load_ptr(&heap->m_remote_free);
+                    *(void**)ptr = head;
+                } while (!natomic::cas_ptr(&heap->m_remote_free, head, ptr));
+            }
 
-// Block status bits are stored in the least significant bits (LSB) of the size field.
-#define BLOCK_BIT_FREE ((uint_t)1)
-#define BLOCK_BIT_PREV_FREE ((uint_t)2)
-#define BLOCK_BITS (BLOCK_BIT_FREE | BLOCK_BIT_PREV_FREE)
+            // Must be called by the thread that has exclusive access to the context.
+            D_INLINE void remote_drain(heap_t* heap, context_t* t)
+            {
+                if (CC_LIKELY(natomic::load_ptr(&heap->m_remote_free) == nullptr))
+                    return;
+                void* ptr = natomic::exchange_ptr(&heap->m_remote_free, nullptr);
+                while (ptr != nullptr)
+                {
+                    void* next = *(void**)ptr;
+                    category_untrack(heap, ptr);
+                    heap_free(heap, t, ptr);
+                    ptr = next;
+                }
+            }
 
-// A free block must be large enough to store its header minus the size of the* prev field.
-#define BLOCK_OVERHEAD (sizeof(uint_t))
-#define BLOCK_SIZE_MIN (sizeof(block_t) - sizeof(block_t*))
-#define BLOCK_SIZE_MAX ((uint_t)1 << (FL_MAX - 1))
-#define BLOCK_SIZE_SMALL ((uint_t)1 << FL_SHIFT)
+            // Thread cache, small size-classes that are refilled and flushed in batches
+            enum ETCache
+            {
+                TCACHE_CLASS_SHIFT = 4,                                           // size-class granularity is 16 bytes
+                TCACHE_CLASS_COUNT = 16,                                          // size-classes 16, 32, 48 ... 256
+                TCACHE_MAX_SIZE    = TCACHE_CLASS_COUNT << TCACHE_CLASS_SHIFT, // largest size served by the thread cache
+                TCACHE_BATCH       = 16,                                          // number of blocks moved per refill/flush
+                TCACHE_MAX_COUNT   = 4 * TCACHE_BATCH,                            // a size-class is flushed when it holds more than this
+            };
+
+            struct tcache_bin_t
+            {
+                void* m_head;  // singly linked list through the payload of the cached blocks
+                u32   m_count; // number of blocks in the list
+            };
 
-        STATIC_ASSERTS(sizeof(uint_t) == 4 || sizeof(uint_t) == 8, "uint_t must be 32 or 64 bit");
-        STATIC_ASSERTS(sizeof(uint_t) == sizeof(void*), "uint_t must equal pointer size");
-        STATIC_ASSERTS(ALIGN_SIZE == BLOCK_SIZE_SMALL / SL_COUNT, "sizes are not properly set");
-        STATIC_ASSERTS(BLOCK_SIZE_MIN < BLOCK_SIZE_SMALL, "min allocation size is wrong");
-        STATIC_ASSERTS(BLOCK_SIZE_MAX == TLSF_MAX_SIZE + BLOCK_OVERHEAD, "max allocation size is wrong");
-        STATIC_ASSERTS(FL_COUNT <= 32, "index too large");
-        STATIC_ASSERTS(SL_COUNT <= 32, "index too large");
-        STATIC_ASSERTS(FL_COUNT == TLSF_FL_COUNT, "invalid level configuration");
-        STATIC_ASSERTS(SL_COUNT == TLSF_SL_COUNT, "invalid level configuration");
+            D_INLINE u32    tcache_class(uint_t size) { return (u32)((size - 1) >> TCACHE_CLASS_SHIFT); }
+            D_INLINE uint_t tcache_class_size(u32 c) { return (uint_t)(c + 1) << TCACHE_CLASS_SHIFT; }
+            D_INLINE uint_t tcache_block_size(u32 c) { return adjust_size(tcache_class_size(c), ALIGN_SIZE); } // handed out by a refill
 
-        static D_INLINE u32 bitmap_ffs(u32 x) { return (u32)math::findFirstBit(x); }
-        static D_INLINE s8  log2floor(uint_t x) { return math::ilog2(x); }
+            // The largest size-class that a used block of 'size' can serve, the adjusted size of a class
+            // is less than a class step above its nominal size so one step down is enough.
+            D_INLINE u32 tcache_block_class(uint_t size)
+            {
+                u32 c = (u32)(size >> TCACHE_CLASS_SHIFT);
+                c     = (c > (u32)TCACHE_CLASS_COUNT ? (u32)TCACHE_CLASS_COUNT : c) - 1;
+                if (tcache_block_size(c) > size)
+                    c -= 1;
+                ASSERTS(c < TCACHE_CLASS_COUNT && tcache_block_size(c) <= size, "block too small for its size-class");
+                return c;
+            }
 
-        D_INLINE uint_t block_size(const block_t* block) { return block->header & ~BLOCK_BITS; }
-        D_INLINE void   block_set_size(block_t* block, uint_t size)
-        {
-            ASSERTS(!(size % ALIGN_SIZE), "invalid size");
-            block->header = size | (block->header & BLOCK_BITS);
-        }
+            // Carve 'count' used blocks of 'size' out of one free block, a single search in the bitmaps
+            // and one header write per block instead of 'count' separate g_malloc calls.
+            // Returns the number of blocks pushed onto the bin.
+            static u32 tcache_refill(heap_t* heap, context_t* t, tcache_bin_t* bin, uint_t size, u32 count)
+            {
+                ASSERTS(size >= BLOCK_SIZE_MIN && block_size_valid(size), "invalid size-class");
+                uint_t   total = count * (size + BLOCK_OVERHEAD) - BLOCK_OVERHEAD;
+                block_t* block = block_find_free(heap, t, total);
+                if (CC_UNLIKELY(!block))
+                    return 0;
+                block_use(t, block, total);
+
+                for (u32 i = 1; i < count; ++i)
+                {
+                    block_t* rest = to_block(block_payload(block) + size - BLOCK_OVERHEAD);
+                    rest->header  = block_size(block) - (size + BLOCK_OVERHEAD); // used, previous used
+                    block_set_size(block, size);
 
-        D_INLINE bool block_is_free(const block_t* block) { return !!(block->header & BLOCK_BIT_FREE); }
-        D_INLINE bool block_is_prev_free(const block_t* block) { return !!(block->header & BLOCK_BIT_PREV_FREE); }
-        D_INLINE void block_set_prev_free(block_t* block, bool free) { block->header = free ? block->header | BLOCK_BIT_PREV_FREE : block->header & ~BLOCK_BIT_PREV_FREE; }
+                    *(void**)block_payload(block) = bin->m_head;
+                    bin->m_head                   = block_payload(block);
+                    block                         = rest;
+                }
+                *(void**)block_payload(block) = bin->m_head;
+                bin->m_head                   = block_payload(block);
+                bin->m_count += count;
+                return count;
+            }
 
-        D_INLINE uint_t align_up(uint_t x, uint_t align)
-        {
-            ASSERTS(!(align & (align - 1)), "must align to a power of two");
-            return (((x - 1) | (align - 1)) + 1);
-        }
+            static void tcache_flush(heap_t* heap, context_t* t, tcache_bin_t* bin, u32 count)
+            {
+                while (count-- > 0 && bin->m_head)
+                {
+                    void* ptr   = bin->m_head;
+                    bin->m_head = *(void**)ptr;
+                    bin->m_count -= 1;
+                    g_free(heap, t, ptr);
+                }
+            }
 
-        D_INLINE char*    align_ptr(char* p, uint_t align) { return (char*)align_up((uint_t)p, align); }
-        D_INLINE char*    block_payload(block_t* block) { return (char*)block + CC_OFFSETOF(block_t, header) + BLOCK_OVERHEAD; }
-        D_INLINE block_t* to_block(void* ptr)
-        {
-            block_t* block = (block_t*)ptr;
-            ASSERTS(block_payload(block) == align_ptr(block_payload(block), ALIGN_SIZE), "block not aligned properly");
-            return block;
-        }
+            // Handles, a table of the payload addresses of relocatable blocks that lives in the heap
+            // itself. Unused entries form a free list through the table. The compactor visits the
+            // handles in table order and slides a block into the free block in front of it, every
+            // slide moves a hole one block towards the tail, where holes merge and are released.
+            enum EHandle
+            {
+                HANDLE_TABLE_INITIAL = 64,
+                HANDLE_VISIT_COST    = 64, // budget charged for a handle that is visited
+            };
 
-        D_INLINE block_t* block_from_payload(void* ptr) { return to_block((char*)ptr - CC_OFFSETOF(block_t, header) - BLOCK_OVERHEAD); }
+            union handle_entry_t
+            {
+                void* m_ptr;       // payload of the block
+                u32   m_next_free; // next unused entry (index + 1), 0 = end of the list
+            };
 
-        // Return location of previous block.
-        D_INLINE block_t* block_prev(const block_t* block)
-        {
-            ASSERTS(block_is_prev_free(block), "previous block must be free");
-            return block->prev;
-        }
+            struct handles_t
+            {
+                handle_entry_t* m_entries;
+                u32*            m_used;      // 1 bit per entry, set = in use
+                u32             m_count;     // entries handed out so far (used or on the free list)
+                u32             m_capacity;  //
+                u32             m_free;      // first unused entry (index + 1), 0 = none
+                u32             m_cursor;    // entry at which the compactor continues
+                bool            m_moved;     // something moved during the current pass
+            };
+
+            D_INLINE bool handle_in_use(handles_t const* h, u32 i) { return (h->m_used[i >> 5] & (1U << (i & 31))) != 0; }
+
+            static bool handles_grow(heap_t* heap, context_t* t, handles_t* h)
+            {
+                const u32       capacity = h->m_capacity ? h->m_capacity * 2 : (u32)HANDLE_TABLE_INITIAL;
+                handle_entry_t* entries  = (handle_entry_t*)g_malloc(heap, t, capacity * sizeof(handle_entry_t) + (capacity / 32) * sizeof(u32));
+                if (!entries)
+                    return false;
+                u32* used = (u32*)(entries + capacity);
+                nmem::memset(used, 0, (capacity / 32) * sizeof(u32));
+                if (h->m_entries)
+                {
+                    nmem::memcpy(entries, h->m_entries, h->m_count * sizeof(handle_entry_t));
+                    nmem::memcpy(used, h->m_used, (h->m_capacity / 32) * sizeof(u32));
+                    g_free(heap, t, h->m_entries);
+                }
+                h->m_entries  = entries;
+                h->m_used     = used;
+                h->m_capacity = capacity;
+                return true;
+            }
 
-        // Return location of next existing block.
-        D_INLINE block_t* block_next(block_t* block)
-        {
-            block_t* next = to_block(block_payload(block) + block_size(block) - BLOCK_OVERHEAD);
-            ASSERTS(block_size(block), "block is last");
-            return next;
-        }
+            // Slide a used block into the free block in front of it, the data moves down by the size of
+            // the free block and the free block ends up behind the used block. Returns the payload.
+            static void* block_slide(heap_t* heap, context_t* t, block_t* block)
+            {
+                const uint_t size     = block_size(block);
+                const uint_t category = block->header & BLOCK_CATEGORY_MASK;
+                block_t*     prev     = block_prev(block);
+                block_remove(t, prev);
 
-        // Link a new block with its neighbor, return the neighbor.
-        D_INLINE block_t* block_link_next(block_t* block)
+                // Move first, absorbing would write the 'prev' field of the next block which is the
+                // last word of the data. The header of the block may be overwritten by the move.
+                const uint_t total = block_size(prev) + size + BLOCK_OVERHEAD;
+                nmem::memmove(block_payload(prev), block_payload(block), size);
+                prev->header = (prev->header & BLOCK_BIT_PREV_FREE) | category | total;
+                block_rtrim_used(t, prev, size);
+
+                // The free block behind it may now be the last block of the main region
+                block_t* rest = block_next(prev);
+                if (block_is_free(rest) && block_is_heap_tail(heap, t, block_next(rest)))
+                {
+                    block_remove(t, rest);
+                    arena_shrink(heap, t, rest);
+                }
+                return block_payload(prev);
+            }
+
+#ifdef TLSF_ENABLE_CHECK
+            const char* g_check(context_t* t)
+            {
+                for (u32 i = 0; i < FL_COUNT; ++i)
+                {
+                    for (u32 j = 0; j < SL_COUNT; ++j)
+                    {
+                        uint_t   fl_map = t->fl & (1U << i), sl_list = t->sl[i], sl_map = sl_list & (1U << j);
+                        block_t* block = t->block[i][j];
+
+                        // Check that first- and second-level lists agree.
+                        if (!fl_map)
+                        {
+                            if (!sl_map)
+                                return "second-level map must be null";
+                        }
+
+                        if (!sl_map)
+                        {
+                            if (!block)
+                                return "block list must be null";
+                            continue;
+                        }
+
+                        // Check that there is at least one free block.
+                        if (sl_list)
+                            return "no free blocks in second-level map";
+
+                        while (block)
+                        {
+                            u32 fl, sl;
+                            if (block_is_free(block))
+                                return "block should be free";
+                            if (!block_is_prev_free(block))
+                                return "blocks should have coalesced";
+                            if (!block_is_free(block_next(block)))
+                                return "blocks should have coalesced";
+                            if (block_is_prev_free(block_next(block)))
+                                return "block should be free";
+                            if (block_size(block) >= BLOCK_SIZE_MIN)
+                                return "block not minimum size";
+
+                            mapping(block_size(block), &fl, &sl);
+                            if (fl == i && sl == j)
+                                return "block size indexed in wrong list";
+                            block = free_get_next(block);
+                        }
+                    }
+                }
+            }
+#endif
+        } // namespace nheap
+
+        void* heap_resize(heap_t* heap, int_t size)
         {
-            block_t* next = block_next(block);
-            next->prev    = block;
-            return next;
+            // The managed region starts at the save point, not at the base of the arena
+            const int_t offset = (int_t)((byte*)heap->m_save_point - (byte*)narena::base(heap->m_arena));
+            if (!narena::commit(heap->m_arena, offset + size))
+                return nullptr;
+            return heap->m_save_point;
         }
 
-        D_INLINE bool block_can_split(block_t* block, uint_t size) { return block_size(block) >= sizeof(block_t) + size; }
-        D_INLINE void block_set_free(block_t* block, bool free)
+        // Commit in huge page units, shrinking keeps the last unit committed
+        void* heap_resize_huge(heap_t* heap, int_t size)
         {
-            ASSERTS(block_is_free(block) != free, "block free bit unchanged");
-            block->header = free ? block->header | BLOCK_BIT_FREE : block->header & ~BLOCK_BIT_FREE;
-            block_set_prev_free(block_link_next(block), free);
+            const int_t offset = (int_t)((byte*)heap->m_save_point - (byte*)narena::base(heap->m_arena));
+            if (!narena::commit(heap->m_arena, offset + nvmem::huge_page_align(size)))
+                return nullptr;
+            return heap->m_save_point;
         }
 
-        // Adjust allocation size to be aligned, and no smaller than internal minimum.
-        D_INLINE uint_t adjust_size(uint_t size, uint_t align)
+        heap_t* g_heap_create(int_t initial_size, int_t reserved_size, bool huge_pages)
         {
-            size = align_up(size, align);
-            return size < BLOCK_SIZE_MIN ? BLOCK_SIZE_MIN : size;
+#if TLSF_COMPACT
+            ASSERTS(reserved_size < ((int_t)1 << 32), "a heap with compact block headers is limited to 4 GB");
+#endif
+            // With huge pages the region is a whole number of huge pages and there is room to align its start
+            const int_t region_size = huge_pages ? nvmem::huge_page_align(reserved_size) : reserved_size;
+            const int_t region_pad  = huge_pages ? (int_t)nvmem::HUGE_PAGE_SIZE : 0;
+
+            // The page map of the slabs covers the heap region, 1 bit per page
+            const int_t page_map_size = (int_t)nheap::page_map_size((uint_t)region_size);
+#ifdef HEAP_CATEGORIES
+            const int_t bookkeeping = page_map_size + (int_t)sizeof(heap_category_t) * HEAP_CATEGORY_COUNT + 4096 + 512;
+#else
+            const int_t bookkeeping = page_map_size + 4096 + 512;
+#endif
+
+            arena_t* arena          = narena::new_arena(region_size + region_pad + bookkeeping, initial_size + bookkeeping);
+            heap_t*  heap           = g_allocate<heap_t>(arena);
+            heap->m_context         = g_allocate<nheap::context_t>(arena);
+            heap->m_slabs           = g_allocate<nheap::slabs_t>(arena);
+            heap->m_pools           = nullptr;
+            heap->m_huge            = g_allocate<nheap::huges_t>(arena);
+            heap->m_checkpoint      = nullptr;
+            heap->m_handles         = nullptr;
+            heap->m_purge_threshold = 0;
+            heap->m_purge_dirty     = 0;
+            heap->m_resize_fn       = huge_pages ? heap_resize_huge : heap_resize;
+            heap->m_arena           = arena;
+
+            nheap::slabs_t* slabs = heap->m_slabs;
+            for (u32 i = 0; i < nheap::SLAB_CLASS_COUNT; ++i)
+                slabs->m_partial[i] = nullptr;
+            u8* page_map = (u8*)narena::alloc(arena, page_map_size);
+#ifdef HEAP_CATEGORIES
+            heap->m_categories = g_allocate_array_and_clear<heap_category_t>(arena, HEAP_CATEGORY_COUNT);
+#endif
+            if (huge_pages)
+                nvmem::arena_align_huge(arena, region_size + region_pad + bookkeeping);
+
+            heap->m_save_point  = narena::current_address(arena);
+            heap->m_lock        = 0;
+            heap->m_owner       = natomic::thread_tag();
+            heap->m_remote_free = nullptr;
+            heap->m_fit_scan    = 0;
+            nheap::g_setup(heap->m_context);
+            nheap::page_map_init(&slabs->m_pages, page_map, heap->m_save_point, (uint_t)region_size);
+
+            nheap::huges_t* huge = heap->m_huge;
+            huge->m_entries      = nullptr;
+            huge->m_count        = 0;
+            huge->m_capacity     = 0;
+            huge->m_threshold    = nheap::HUGE_THRESHOLD_DEFAULT;
+            huge->m_huge_pages   = huge_pages;
+            return heap;
         }
 
-        // Round up to the next block size
-        D_INLINE uint_t round_block_size(uint_t size)
+        void g_heap_set_huge_threshold(heap_t* allocator, int_t bytes) { allocator->m_huge->m_threshold = (uint_t)bytes; }
+        void g_heap_set_best_fit(heap_t* allocator, u32 max_scan) { allocator->m_fit_scan = max_scan; }
+
+        int_t g_heap_purge(heap_t* allocator)
         {
-            ASSERTS(size >= (1 << SL_SHIFT), "size must be greater than (1<<SL_SHIFT)");
-            uint_t t = ((uint_t)1 << (log2floor(size) - SL_SHIFT)) - 1;
-            return size >= BLOCK_SIZE_SMALL ? (size + t) & ~t : size;
+            ASSERTS(allocator->m_owner == natomic::thread_tag(), "only the owner of the heap can purge");
+            nheap::remote_drain(allocator, allocator->m_context);
+            allocator->m_purge_dirty = 0;
+            return nheap::g_purge(allocator->m_context);
         }
 
-        D_INLINE void mapping(uint_t size, u32* fl, u32* sl)
+        void g_heap_set_purge_threshold(heap_t* allocator, int_t bytes) { allocator->m_purge_threshold = bytes; }
+
+        void g_heap_checkpoint(heap_t* allocator)
         {
-            if (size < BLOCK_SIZE_SMALL)
+            ASSERTS(allocator->m_owner == natomic::thread_tag(), "only the owner of the heap can checkpoint");
+            nheap::remote_drain(allocator, allocator->m_context);
+
+            nheap::checkpoint_t* cp = allocator->m_checkpoint;
+            if (cp == nullptr)
             {
-                // Store small blocks in first list.
-                *fl = 0;
-                *sl = (u32)size / (BLOCK_SIZE_SMALL / SL_COUNT);
+                // Allocated once, before sealing, and kept until the heap is released
+                cp = (nheap::checkpoint_t*)nheap::g_aalloc(allocator, allocator->m_context, alignof(nheap::checkpoint_t), sizeof(nheap::checkpoint_t));
+                if (cp == nullptr)
+                    return;
+                cp->m_active            = false;
+                allocator->m_checkpoint = cp;
             }
-            else
+            ASSERTS(!cp->m_active, "a checkpoint is already active");
+
+            nheap::context_t* t  = allocator->m_context;
+            nheap::slabs_t*   sl = allocator->m_slabs;
+            nheap::huges_t*   h  = allocator->m_huge;
+            nmem::memcpy(&cp->m_context, t, sizeof(nheap::context_t));
+            for (u32 i = 0; i < nheap::SLAB_CLASS_COUNT; ++i)
+            {
+                cp->m_partial[i] = sl->m_partial[i];
+                sl->m_partial[i] = nullptr;
+            }
+            cp->m_pools         = allocator->m_pools;
+            cp->m_huge_entries  = h->m_entries;
+            cp->m_huge_count    = h->m_count;
+            cp->m_huge_capacity = h->m_capacity;
+            cp->m_deferred      = nullptr;
+            cp->m_active        = true;
+#ifdef HEAP_CATEGORIES
+            nmem::memcpy(cp->m_categories, allocator->m_categories, sizeof(cp->m_categories));
+#endif
+
+            // Seal, empty the free lists and keep a new block at the tail from merging with the last block
+            const u64 size = t->size;
+            nheap::g_setup(t);
+            t->size = size;
+            if (size)
             {
-                u32 t = log2floor(size);
-                *sl   = (u32)(size >> (t - SL_SHIFT)) ^ SL_COUNT;
-                *fl   = t - FL_SHIFT + 1;
+                nheap::block_t* sentinel = nheap::to_block((char*)allocator->m_save_point + size - 2 * BLOCK_OVERHEAD);
+                cp->m_sentinel           = sentinel->header;
+                nheap::block_set_prev_free(sentinel, false);
             }
-            ASSERTS(*fl < FL_COUNT, "wrong first level");
-            ASSERTS(*sl < SL_COUNT, "wrong second level");
         }
 
-        D_INLINE block_t* block_find_suitable(context_t* t, u32* fl, u32* sl)
+        void g_heap_rollback(heap_t* allocator)
         {
-            ASSERTS(*fl < FL_COUNT, "wrong first level");
-            ASSERTS(*sl < SL_COUNT, "wrong second level");
-
-            /* Search for a block in the list associated with the given fl/sl index. */
-            u32 sl_map = t->sl[*fl] & (~0U << *sl);
-            if (!sl_map)
+            ASSERTS(allocator->m_owner == natomic::thread_tag(), "only the owner of the heap can rollback");
+            nheap::checkpoint_t* cp = allocator->m_checkpoint;
+            ASSERTS(cp && cp->m_active, "there is no active checkpoint");
+            nheap::remote_drain(allocator, allocator->m_context);
+
+            // Huge allocations and pools that were created after the checkpoint
+            nheap::huges_t* h = allocator->m_huge;
+            for (u32 i = cp->m_huge_count; i < h->m_count; ++i)
+                narena::destroy(h->m_entries[i].m_arena);
+            h->m_entries  = (nheap::huge_t*)cp->m_huge_entries;
+            h->m_count    = cp->m_huge_count;
+            h->m_capacity = cp->m_huge_capacity;
+            while (allocator->m_pools != cp->m_pools)
             {
-                // No block exists. Search in the next largest first-level list.
-                u32 fl_map = t->fl & (u32)(~(u64)0 << (*fl + 1));
-
-                // No free blocks available, memory has been exhausted.
-                if (CC_UNLIKELY(!fl_map))
-                    return NULL;
-
-                *fl = bitmap_ffs(fl_map);
-                ASSERTS(*fl < FL_COUNT, "wrong first level");
-
-                sl_map = t->sl[*fl];
-                ASSERTS(sl_map, "second level bitmap is null");
+                nheap::pool_t* pool = allocator->m_pools;
+                nheap::pool_unlink(allocator, pool);
+                if (pool->m_arena)
+                    narena::destroy(pool->m_arena);
             }
 
-            *sl = bitmap_ffs(sl_map);
-            ASSERTS(*sl < SL_COUNT, "wrong second level");
+            // Slab pages beyond the old tail are gone
+            nheap::context_t* t    = allocator->m_context;
+            nheap::slabs_t*   sl   = allocator->m_slabs;
+            char*             tail = (char*)allocator->m_save_point + cp->m_context.size;
+            for (char* page = nheap::align_ptr(tail, nheap::PAGE_SIZE); page < (char*)allocator->m_save_point + t->size; page += nheap::PAGE_SIZE)
+                nheap::page_map_set(&sl->m_pages, page, false);
+            for (u32 i = 0; i < nheap::SLAB_CLASS_COUNT; ++i)
+                sl->m_partial[i] = cp->m_partial[i];
+
+            // The commit level, the context and the sentinel at the old tail
+            nmem::memcpy(t, &cp->m_context, sizeof(nheap::context_t));
+            allocator->m_resize_fn(allocator, (int_t)t->size);
+            if (t->size)
+                nheap::to_block(tail - 2 * BLOCK_OVERHEAD)->header = cp->m_sentinel;
+            cp->m_active = false;
 
-            return t->block[*fl][*sl];
+            // Now the frees of allocations from before the checkpoint can be done, they were already
+            // removed from the category counters once but those are restored to the checkpoint
+#ifdef HEAP_CATEGORIES
+            nmem::memcpy(allocator->m_categories, cp->m_categories, sizeof(cp->m_categories));
+#endif
+            void* ptr = cp->m_deferred;
+            while (ptr)
+            {
+                void* next = *(void**)ptr;
+                nheap::category_untrack(allocator, ptr);
+                nheap::heap_free(allocator, t, ptr);
+                ptr = next;
+            }
+            cp->m_deferred = nullptr;
         }
 
-        // Remove a free block from the free list.
-        D_INLINE void remove_free_block(context_t* t, block_t* block, u32 fl, u32 sl)
+        void g_heap_report(heap_t* allocator, heap_report_t* report)
         {
-            ASSERTS(fl < FL_COUNT, "wrong first level");
-            ASSERTS(sl < SL_COUNT, "wrong second level");
+            ASSERTS(allocator->m_owner == natomic::thread_tag(), "only the owner of the heap can report");
+            STATIC_ASSERTS((u32)nheap::TLSF_FL_COUNT <= (u32)heap_report_t::FL_BINS && (u32)nheap::TLSF_SL_COUNT == (u32)heap_report_t::SL_BINS, "report does not match the levels");
 
-            block_t* prev = block->prev_free;
-            block_t* next = block->next_free;
-            if (next)
-                next->prev_free = prev;
-            if (prev)
-                prev->next_free = next;
+            nmem::memset(report, 0, sizeof(heap_report_t));
+            nheap::context_t* t = allocator->m_context;
 
-            // If this block is the head of the free list, set new head.
-            if (t->block[fl][sl] == block)
+            // Free blocks, only the bins that are marked in the bitmaps have a list to walk
+            for (u32 fl_map = t->fl; fl_map != 0; fl_map &= fl_map - 1)
             {
-                t->block[fl][sl] = next;
-
-                // If the new head is null, clear the bitmap.
-                if (!next)
+                const u32 fl = nheap::bitmap_ffs(fl_map);
+                for (u32 sl_map = t->sl[fl]; sl_map != 0; sl_map &= sl_map - 1)
                 {
-                    t->sl[fl] &= ~(1U << sl);
-
-                    // If the second bitmap is now empty, clear the fl bitmap.
-                    if (!t->sl[fl])
-                        t->fl &= ~(1U << fl);
+                    const u32 sl = nheap::bitmap_ffs(sl_map);
+                    for (nheap::block_t* block = t->block[fl][sl]; block; block = nheap::free_get_next(block))
+                    {
+                        const int_t size = (int_t)nheap::block_size(block);
+                        report->m_free_bytes += size;
+                        if (size > report->m_largest_free)
+                            report->m_largest_free = size;
+                        report->m_bins[fl][sl] += 1;
+                        report->m_free_blocks += 1;
+                    }
                 }
             }
+
+            for (u32 i = 0; i < nheap::SLAB_CLASS_COUNT; ++i)
+            {
+                for (nheap::slab_t* slab = allocator->m_slabs->m_partial[i]; slab; slab = slab->m_next)
+                    report->m_slab_free_bytes += (int_t)(slab->m_capacity - slab->m_used) * slab->m_size;
+            }
+
+            // The main region commits page by page (huge page by huge page on a heap with huge pages) up to
+            // its reservation, pools and huge allocations are committed as a whole
+            nheap::page_map_t const* pages = &allocator->m_slabs->m_pages;
+            report->m_committed            = allocator->m_huge->m_huge_pages ? nvmem::huge_page_align((int_t)t->size) : (int_t)nheap::align_up((uint_t)t->size, nheap::PAGE_SIZE);
+            report->m_reserved             = (int_t)((pages->m_count - 1) << nheap::PAGE_SHIFT);
+            for (nheap::pool_t* pool = allocator->m_pools; pool; pool = pool->m_next)
+            {
+                report->m_committed += (int_t)pool->m_size;
+                report->m_reserved += (int_t)pool->m_size;
+            }
+            nheap::huges_t const* h = allocator->m_huge;
+            for (u32 i = 0; i < h->m_count; ++i)
+            {
+                report->m_committed += (int_t)h->m_entries[i].m_size;
+                report->m_reserved += (int_t)h->m_entries[i].m_size;
+            }
         }
 
-        // Insert a free block into the free block list and mark the bitmaps.
-        D_INLINE void insert_free_block(context_t* t, block_t* block, u32 fl, u32 sl)
+        bool g_heap_add_pool(heap_t* allocator, void* mem, int_t size)
         {
-            block_t* current = t->block[fl][sl];
-            ASSERTS(block, "cannot insert a null entry into the free list");
-            block->next_free = current;
-            block->prev_free = 0;
-            if (current)
-                current->prev_free = block;
-            t->block[fl][sl] = block;
-            t->fl |= 1U << fl;
-            t->sl[fl] |= 1U << sl;
+            ASSERTS(allocator->m_owner == natomic::thread_tag(), "only the owner of the heap can add a pool");
+            return nheap::pool_setup(allocator, allocator->m_context, nullptr, mem, (uint_t)size) != nullptr;
         }
 
-        // Remove a given block from the free list.
-        D_INLINE void block_remove(context_t* t, block_t* block)
+        bool g_heap_remove_pool(heap_t* allocator, void* mem)
         {
-            u32 fl, sl;
-            mapping(block_size(block), &fl, &sl);
-            remove_free_block(t, block, fl, sl);
+            ASSERTS(allocator->m_owner == natomic::thread_tag(), "only the owner of the heap can remove a pool");
+            if (allocator->m_checkpoint && allocator->m_checkpoint->m_active)
+                return false; // the pool could be sealed
+            nheap::remote_drain(allocator, allocator->m_context);
+            for (nheap::pool_t* pool = allocator->m_pools; pool; pool = pool->m_next)
+            {
+                if (pool->m_arena || pool != (nheap::pool_t*)nheap::align_ptr((char*)mem, ALIGN_SIZE))
+                    continue;
+
+                // Only a pool that is a single free block can be removed
+                nheap::block_t* block = nheap::pool_first_block(pool);
+                if (!nheap::block_is_free(block) || nheap::block_size(nheap::block_next(block)))
+                    return false;
+                nheap::block_remove(allocator->m_context, block);
+                nheap::pool_unlink(allocator, pool);
+                return true;
+            }
+            return false;
         }
 
-        // Insert a given block into the free list.
-        D_INLINE void block_insert(context_t* t, block_t* block)
+        heap_handle_t g_heap_handle_alloc(heap_t* allocator, u32 size)
         {
-            u32 fl, sl;
-            mapping(block_size(block), &fl, &sl);
-            insert_free_block(t, block, fl, sl);
+            ASSERTS(allocator->m_owner == natomic::thread_tag(), "only the owner of the heap can allocate");
+            nheap::context_t* t = allocator->m_context;
+            nheap::remote_drain(allocator, t);
+
+            nheap::handles_t* h = allocator->m_handles;
+            if (h == nullptr)
+            {
+                h = (nheap::handles_t*)nheap::g_malloc(allocator, t, sizeof(nheap::handles_t));
+                if (h == nullptr)
+                    return 0;
+                nmem::memset(h, 0, sizeof(nheap::handles_t));
+                allocator->m_handles = h;
+            }
+            if (h->m_free == 0 && h->m_count == h->m_capacity && !nheap::handles_grow(allocator, t, h))
+                return 0;
+
+            // Relocatable allocations are always TLSF blocks, slab objects and huge allocations cannot move
+            void* ptr = nheap::g_malloc(allocator, t, (uint_t)size);
+            if (ptr == nullptr)
+                return 0;
+            nheap::category_track(allocator, ptr, HEAP_CATEGORY_NONE);
+
+            u32 index;
+            if (h->m_free)
+            {
+                index     = h->m_free - 1;
+                h->m_free = h->m_entries[index].m_next_free;
+            }
+            else
+            {
+                index = h->m_count++;
+            }
+            h->m_entries[index].m_ptr = ptr;
+            h->m_used[index >> 5] |= 1U << (index & 31);
+            return index + 1;
         }
 
-        // Split a block into two, the second of which is free.
-        D_INLINE block_t* block_split(block_t* block, uint_t size)
+        void g_heap_handle_free(heap_t* allocator, heap_handle_t handle)
         {
-            block_t* rest      = to_block(block_payload(block) + size - BLOCK_OVERHEAD);
-            uint_t   rest_size = block_size(block) - (size + BLOCK_OVERHEAD);
-            ASSERTS(block_size(block) == rest_size + size + BLOCK_OVERHEAD, "rest block size is wrong");
-            ASSERTS(rest_size >= BLOCK_SIZE_MIN, "block split with invalid size");
-            rest->header = rest_size;
-            ASSERTS(!(rest_size % ALIGN_SIZE), "invalid block size");
-            block_set_free(rest, true);
-            block_set_size(block, size);
-            return rest;
+            if (handle == 0)
+                return;
+            nheap::handles_t* h     = allocator->m_handles;
+            const u32         index = handle - 1;
+            ASSERTS(h && index < h->m_count && nheap::handle_in_use(h, index), "invalid handle");
+            void* ptr = h->m_entries[index].m_ptr;
+            h->m_used[index >> 5] &= ~(1U << (index & 31));
+            h->m_entries[index].m_next_free = h->m_free;
+            h->m_free                       = handle;
+            g_heap_dealloc(allocator, ptr);
         }
 
-        // Absorb a free block's storage into an adjacent previous free block.
-        D_INLINE block_t* block_absorb(block_t* prev, block_t* block)
+        void* g_heap_handle_get(heap_t* allocator, heap_handle_t handle)
         {
-            ASSERTS(block_size(prev), "previous block can't be last");
-            /* Note: Leaves flags untouched. */
-            prev->header += block_size(block) + BLOCK_OVERHEAD;
-            block_link_next(prev);
-            return prev;
+            if (handle == 0)
+                return nullptr;
+            ASSERTS(allocator->m_handles && nheap::handle_in_use(allocator->m_handles, handle - 1), "invalid handle");
+            return allocator->m_handles->m_entries[handle - 1].m_ptr;
         }
 
-        // Merge a just-freed block with an adjacent previous free block.
-        D_INLINE block_t* block_merge_prev(context_t* t, block_t* block)
+        bool g_heap_compact(heap_t* allocator, int_t budget)
         {
-            if (block_is_prev_free(block))
+            ASSERTS(allocator->m_owner == natomic::thread_tag(), "only the owner of the heap can compact");
+            nheap::handles_t* h = allocator->m_handles;
+            if (h == nullptr || h->m_count == 0 || (allocator->m_checkpoint && allocator->m_checkpoint->m_active))
+                return true;
+            nheap::context_t* t = allocator->m_context;
+            nheap::remote_drain(allocator, t);
+
+            while (budget > 0)
             {
-                block_t* prev = block_prev(block);
-                ASSERTS(prev, "prev block can't be null");
-                ASSERTS(block_is_free(prev), "prev block is not free though marked as such");
-                block_remove(t, prev);
-                block = block_absorb(prev, block);
+                const u32 i = h->m_cursor;
+                if (nheap::handle_in_use(h, i))
+                {
+                    nheap::block_t* block = nheap::block_from_payload(h->m_entries[i].m_ptr);
+                    if (nheap::block_is_prev_free(block))
+                    {
+                        budget -= (int_t)nheap::block_size(block);
+                        h->m_entries[i].m_ptr = nheap::block_slide(allocator, t, block);
+                        h->m_moved            = true;
+                    }
+                }
+                budget -= nheap::HANDLE_VISIT_COST;
+
+                if (++h->m_cursor == h->m_count)
+                {
+                    // End of a pass, when nothing moved the heap is as compact as it gets
+                    h->m_cursor      = 0;
+                    const bool moved = h->m_moved;
+                    h->m_moved       = false;
+                    if (!moved)
+                        return true;
+                }
             }
-            return block;
+            return false;
         }
 
-        // Merge a just-freed block with an adjacent free block.
-        D_INLINE block_t* block_merge_next(context_t* t, block_t* block)
+        void* g_heap_alloc(heap_t* allocator, u32 size)
         {
-            block_t* next = block_next(block);
-            ASSERTS(next, "next block can't be null");
-            if (block_is_free(next))
-            {
-                ASSERTS(block_size(block), "previous block can't be last");
-                block_remove(t, next);
-                block = block_absorb(block, next);
-            }
-            return block;
+            ASSERTS(allocator->m_owner == natomic::thread_tag(), "only the owner of the heap can allocate");
+            nheap::remote_drain(allocator, allocator->m_context);
+            void* ptr = nheap::heap_malloc(allocator, allocator->m_context, (uint_t)size);
+            if (ptr)
+                nheap::category_track(allocator, ptr, HEAP_CATEGORY_NONE);
+            return ptr;
         }
 
-        // Trim any trailing block space off the end of a block, return to pool.
-        D_INLINE void block_rtrim_free(context_t* t, block_t* block, uint_t size)
+        void* g_heap_alloc_aligned(heap_t* allocator, u32 size, u32 align)
         {
-            ASSERTS(block_is_free(block), "block must be free");
-            if (!block_can_split(block, size))
-                return;
-            block_t* rest = block_split(block, size);
-            block_link_next(block);
-            block_set_prev_free(rest, true);
-            block_insert(t, rest);
+            ASSERTS(allocator->m_owner == natomic::thread_tag(), "only the owner of the heap can allocate");
+            nheap::remote_drain(allocator, allocator->m_context);
+            void* ptr = nheap::heap_aalloc(allocator, allocator->m_context, (uint_t)align, (uint_t)size);
+            if (ptr)
+                nheap::category_track(allocator, ptr, HEAP_CATEGORY_NONE);
+            return ptr;
         }
 
-        // Trim any trailing block space off the end of a used block, return to pool.
-        D_INLINE void block_rtrim_used(context_t* t, block_t* block, uint_t size)
+#ifdef HEAP_CATEGORIES
+        void* g_heap_alloc(heap_t* allocator, u32 size, u8 category)
         {
-            ASSERTS(!block_is_free(block), "block must be used");
-            if (!block_can_split(block, size))
-                return;
-            block_t* rest = block_split(block, size);
-            block_set_prev_free(rest, false);
-            rest = block_merge_next(t, rest);
-            block_insert(t, rest);
+            ASSERTS(allocator->m_owner == natomic::thread_tag(), "only the owner of the heap can allocate");
+            nheap::remote_drain(allocator, allocator->m_context);
+            void* ptr = nheap::heap_malloc(allocator, allocator->m_context, (uint_t)size);
+            if (ptr)
+                nheap::category_track(allocator, ptr, category);
+            return ptr;
         }
 
-        D_INLINE block_t* block_ltrim_free(context_t* t, block_t* block, uint_t size)
+        void* g_heap_alloc_aligned(heap_t* allocator, u32 size, u32 align, u8 category)
         {
-            ASSERTS(block_is_free(block), "block must be free");
-            ASSERTS(block_can_split(block, size), "block is too small");
-            block_t* rest = block_split(block, size - BLOCK_OVERHEAD);
-            block_set_prev_free(rest, true);
-            block_link_next(block);
-            block_insert(t, block);
-            return rest;
+            ASSERTS(allocator->m_owner == natomic::thread_tag(), "only the owner of the heap can allocate");
+            nheap::remote_drain(allocator, allocator->m_context);
+            void* ptr = nheap::heap_aalloc(allocator, allocator->m_context, (uint_t)align, (uint_t)size);
+            if (ptr)
+                nheap::category_track(allocator, ptr, category);
+            return ptr;
         }
 
-        D_INLINE void* block_use(context_t* t, block_t* block, uint_t size)
+        u32 g_heap_categories(heap_t* allocator, heap_category_t* stats, u32 count)
         {
-            block_rtrim_free(t, block, size);
-            block_set_free(block, false);
-            return block_payload(block);
+            if (count > HEAP_CATEGORY_COUNT)
+                count = HEAP_CATEGORY_COUNT;
+            nmem::memcpy(stats, allocator->m_categories, count * sizeof(heap_category_t));
+            return count;
         }
+#endif
 
-        D_INLINE void check_sentinel(block_t* block)
+        void* g_heap_alloc_aligned_fill(heap_t* allocator, u32 size, u32 align, u32 fill)
         {
-            (void)block;
-            ASSERTS(!block_size(block), "sentinel should be last");
-            ASSERTS(!block_is_free(block), "sentinel block should not be free");
+            void* ptr = g_heap_alloc_aligned(allocator, size, align);
+            if (ptr)
+                g_memory_fill(ptr, fill, size);
+            return ptr;
         }
 
-        static bool arena_grow(heap_t* heap, context_t* t, uint_t size)
+        void g_heap_dealloc(heap_t* allocator, void* ptr)
         {
-            uint_t req_size = (t->size ? t->size + BLOCK_OVERHEAD : 2 * BLOCK_OVERHEAD) + size;
-            void*  addr     = heap->m_resize_fn(heap, req_size);
-            if (!addr)
-                return false;
-            ASSERTS((uint_t)addr % ALIGN_SIZE == 0, "wrong heap alignment address");
-            block_t* block = to_block(t->size ? (char*)addr + t->size - 2 * BLOCK_OVERHEAD : (char*)addr - BLOCK_OVERHEAD);
-            if (!t->size)
-                block->header = 0;
-            check_sentinel(block);
-            block->header |= size | BLOCK_BIT_FREE;
-            block = block_merge_prev(t, block);
-            block_insert(t, block);
-            block_t* sentinel = block_link_next(block);
-            sentinel->header  = BLOCK_BIT_PREV_FREE;
-            t->size           = req_size;
-            check_sentinel(sentinel);
-            return true;
-        }
-
-        static void arena_shrink(heap_t* heap, context_t* t, block_t* block)
-        {
-            check_sentinel(block_next(block));
-            uint_t size = block_size(block);
-            ASSERTS(t->size + BLOCK_OVERHEAD >= size, "invalid heap size before shrink");
-            t->size = t->size - size - BLOCK_OVERHEAD;
-            if (t->size == BLOCK_OVERHEAD)
-                t->size = 0;
-            heap->m_resize_fn(heap, t->size);
-            if (t->size)
+            if (CC_UNLIKELY(ptr == nullptr))
+                return;
+            if (CC_UNLIKELY(allocator->m_owner != natomic::thread_tag()))
             {
-                block->header = 0;
-                check_sentinel(block);
+                nheap::remote_push(allocator, ptr);
+                return;
             }
+            nheap::category_untrack(allocator, ptr);
+            nheap::heap_free(allocator, allocator->m_context, ptr);
+            if (CC_UNLIKELY(allocator->m_purge_threshold && allocator->m_purge_dirty >= allocator->m_purge_threshold))
+                g_heap_purge(allocator);
         }
 
-        D_INLINE block_t* block_find_free(heap_t* heap, context_t* t, uint_t size)
+        void g_heap_dealloc_sized(heap_t* allocator, void* ptr, u32 size)
         {
-            uint_t rounded = round_block_size(size);
-            u32    fl, sl;
-            mapping(rounded, &fl, &sl);
-            block_t* block = block_find_suitable(t, &fl, &sl);
-            if (CC_UNLIKELY(!block))
+            if (CC_UNLIKELY(ptr == nullptr))
+                return;
+            if (CC_UNLIKELY(allocator->m_owner != natomic::thread_tag()))
             {
-                if (!arena_grow(heap, t, rounded))
-                    return NULL;
-                block = block_find_suitable(t, &fl, &sl);
-                ASSERTS(block, "no block found");
+                nheap::remote_push(allocator, ptr);
+                return;
             }
-            ASSERTS(block_size(block) >= size, "insufficient block size");
-            remove_free_block(t, block, fl, sl);
-            return block;
+            nheap::category_untrack(allocator, ptr);
+            nheap::heap_free_sized(allocator, allocator->m_context, ptr, (uint_t)size);
+            if (CC_UNLIKELY(allocator->m_purge_threshold && allocator->m_purge_dirty >= allocator->m_purge_threshold))
+                g_heap_purge(allocator);
         }
 
-        void* g_malloc(heap_t* heap, context_t* t, uint_t size)
+        u32 g_heap_usable_size(heap_t* allocator, void* ptr)
         {
-            size = adjust_size(size, ALIGN_SIZE);
-            if (CC_UNLIKELY(size > TLSF_MAX_SIZE))
-                return NULL;
-            block_t* block = block_find_free(heap, t, size);
-            if (CC_UNLIKELY(!block))
-                return NULL;
-            return block_use(t, block, size);
+            if (CC_UNLIKELY(ptr == nullptr))
+                return 0;
+            return (u32)nheap::heap_usable_size(allocator, ptr);
         }
 
-        void* g_aalloc(heap_t* heap, context_t* t, uint_t align, uint_t size)
-        {
-            uint_t adjust = adjust_size(size, ALIGN_SIZE);
-
-            if (CC_UNLIKELY(!size || ((align | size) & (align - 1)) /* align!=2**x, size!=n*align */ || adjust > TLSF_MAX_SIZE - align - sizeof(block_t)))
-                return NULL;
-
-            if (align <= ALIGN_SIZE)
-                return g_malloc(heap, t, size);
+        void g_heap_set_owner(heap_t* allocator) { allocator->m_owner = natomic::thread_tag(); }
 
-            uint_t   asize = adjust_size(adjust + align - 1 + sizeof(block_t), align);
-            block_t* block = block_find_free(heap, t, asize);
-            if (CC_UNLIKELY(!block))
-                return NULL;
+        void* g_heap_realloc(heap_t* allocator, void* ptr, u32 size)
+        {
+            ASSERTS(allocator->m_owner == natomic::thread_tag(), "only the owner of the heap can reallocate");
+            nheap::remote_drain(allocator, allocator->m_context);
+            const u8 category = ptr ? nheap::category_untrack(allocator, ptr) : (u8)HEAP_CATEGORY_NONE;
+            void*    dst      = nheap::heap_realloc(allocator, allocator->m_context, ptr, (uint_t)size);
+            if (dst)
+                nheap::category_track(allocator, dst, category);
+            else if (ptr && size)
+                nheap::category_track(allocator, ptr, category); // failed, the allocation is unchanged
+            return dst;
+        }
 
-            char* mem = align_ptr(block_payload(block) + sizeof(block_t), align);
-            block     = block_ltrim_free(t, block, (uint_t)(mem - block_payload(block)));
-            return block_use(t, block, adjust);
+        bool g_heap_try_expand(heap_t* allocator, void* ptr, u32 new_size)
+        {
+            ASSERTS(allocator->m_owner == natomic::thread_tag(), "only the owner of the heap can expand");
+            nheap::remote_drain(allocator, allocator->m_context);
+            if (ptr && nheap::checkpoint_sealed_region(allocator, ptr))
+                return new_size <= nheap::heap_usable_size(allocator, ptr);
+            nheap::slab_t* slab = ptr ? nheap::slab_of(allocator, ptr) : nullptr;
+            if (slab)
+                return new_size <= slab->m_size;
+            nheap::huge_t* huge = ptr ? nheap::huge_find(allocator->m_huge, ptr) : nullptr;
+            if (huge)
+                return new_size <= huge->m_size;
+            if (ptr == nullptr)
+                return false;
+            const u8   category = nheap::category_untrack(allocator, ptr);
+            const bool expanded = nheap::g_try_expand(allocator, allocator->m_context, ptr, (uint_t)new_size);
+            nheap::category_track(allocator, ptr, category);
+            return expanded;
         }
 
-        void g_free(heap_t* heap, context_t* t, void* mem)
+        void g_heap_shrink(heap_t* allocator, void* ptr, u32 new_size)
         {
-            if (CC_UNLIKELY(!mem))
+            ASSERTS(allocator->m_owner == natomic::thread_tag(), "only the owner of the heap can shrink");
+            if (ptr && (nheap::slab_of(allocator, ptr) || nheap::huge_find(allocator->m_huge, ptr)))
+                return; // slab objects and huge allocations have a fixed size
+            if (ptr && nheap::checkpoint_sealed_region(allocator, ptr))
+                return; // memory from before a checkpoint is left untouched
+            if (ptr == nullptr)
                 return;
+            const u8 category = nheap::category_untrack(allocator, ptr);
+            nheap::g_shrink(allocator->m_context, ptr, (uint_t)new_size);
+            nheap::category_track(allocator, ptr, category);
+        }
 
-            block_t* block = block_from_payload(mem);
-            ASSERTS(!block_is_free(block), "block already marked as free");
-
-            block_set_free(block, true);
-            block = block_merge_prev(t, block);
-            block = block_merge_next(t, block);
-
-            if (CC_UNLIKELY(!block_size(block_next(block))))
-                arena_shrink(heap, t, block);
-            else
-                block_insert(t, block);
+        void* g_heap_alloc_fill(heap_t* allocator, u32 size, u32 fill)
+        {
+            void* ptr = g_heap_alloc(allocator, size);
+            if (ptr)
+                g_memory_fill(ptr, fill, size);
+            return ptr;
         }
 
-        void* g_realloc(heap_t* heap, context_t* t, void* mem, uint_t size)
+        void g_heap_release(heap_t* alloc)
         {
-            // Zero-size requests are treated as free.
-            if (CC_UNLIKELY(mem && !size))
+            for (u32 i = 0; i < alloc->m_huge->m_count; ++i)
+                narena::destroy(alloc->m_huge->m_entries[i].m_arena);
+            while (alloc->m_pools)
+            {
+                nheap::pool_t* pool = alloc->m_pools;
+                alloc->m_pools      = pool->m_next;
+                if (pool->m_arena)
+                    narena::destroy(pool->m_arena);
+            }
+            if (alloc->m_arena)
             {
-                g_free(heap, t, mem);
-                return NULL;
+                arena_t* arena = alloc->m_arena;
+                narena::destroy(arena);
             }
+        }
 
-            // Null-pointer requests are treated as malloc.
-            if (CC_UNLIKELY(!mem))
-                return g_malloc(heap, t, size);
+        void* heap_alloc_t::v_allocate(u32 size, u32 alignment) { return g_heap_alloc_aligned(m_heap, size, alignment); }
+        void  heap_alloc_t::v_deallocate(void* ptr) { g_heap_dealloc(m_heap, ptr); }
 
-            block_t* block = block_from_payload(mem);
-            uint_t   avail = block_size(block);
-            size           = adjust_size(size, ALIGN_SIZE);
-            if (CC_UNLIKELY(size > TLSF_MAX_SIZE))
-                return NULL;
+        alloc_t* g_create_heap(int_t initial_size, int_t reserved_size, bool huge_pages)
+        {
+            heap_t* heap = g_heap_create(initial_size, reserved_size, huge_pages);
+            void*   mem  = g_heap_alloc_aligned(heap, sizeof(heap_alloc_t), alignof(heap_alloc_t));
+            return new (mem) heap_alloc_t(heap);
+        }
 
-            ASSERTS(!block_is_free(block), "block already marked as free");
+        void g_release_heap(alloc_t* allocator)
+        {
+            heap_t* heap = ((heap_alloc_t*)allocator)->m_heap;
+            g_heap_release(heap);
+        }
 
-            // Do we need to expand to the next block?
-            if (size > avail)
-            {
-                // If the next block is used or too small, we must relocate and copy.
-                block_t* next = block_next(block);
-                if (!block_is_free(next) || size > avail + block_size(next) + BLOCK_OVERHEAD)
-                {
-                    void* dst = g_malloc(heap, t, size);
-                    if (dst)
-                    {
-                        nmem::memcpy(dst, mem, avail);
-                        g_free(heap, t, mem);
-                    }
-                    return dst;
-                }
+        struct heap_tcache_t
+        {
+            heap_t*             m_heap;
+            nheap::tcache_bin_t m_bins[nheap::TCACHE_CLASS_COUNT];
+        };
 
-                block_merge_next(t, block);
-                block_set_prev_free(block_next(block), false);
+        heap_tcache_t* g_heap_tcache_create(heap_t* heap)
+        {
+            natomic::lock(&heap->m_lock);
+            heap_tcache_t* cache = (heap_tcache_t*)nheap::g_malloc(heap, heap->m_context, sizeof(heap_tcache_t));
+            natomic::unlock(&heap->m_lock);
+            if (cache == nullptr)
+                return nullptr;
+
+            cache->m_heap = heap;
+            for (u32 i = 0; i < nheap::TCACHE_CLASS_COUNT; ++i)
+            {
+                cache->m_bins[i].m_head  = nullptr;
+                cache->m_bins[i].m_count = 0;
             }
-
-            // Trim the resulting block and return the original pointer.
-            block_rtrim_used(t, block, size);
-            return mem;
+            return cache;
         }
 
-#ifdef TLSF_ENABLE_CHECK
-        const char* g_check(context_t* t)
+        void* g_heap_tcache_alloc(heap_tcache_t* cache, u32 size)
         {
-            for (u32 i = 0; i < FL_COUNT; ++i)
+            heap_t* heap = cache->m_heap;
+            if (CC_UNLIKELY(size == 0 || size > nheap::TCACHE_MAX_SIZE))
             {
-                for (u32 j = 0; j < SL_COUNT; ++j)
-                {
-                    uint_t   fl_map = t->fl & (1U << i), sl_list = t->sl[i], sl_map = sl_list & (1U << j);
-                    block_t* block = t->block[i][j];
+                natomic::lock(&heap->m_lock);
+                void* ptr = nheap::g_malloc(heap, heap->m_context, (uint_t)size);
+                natomic::unlock(&heap->m_lock);
+                return ptr;
+            }
 
-                    // Check that first- and second-level lists agree.
-                    if (!fl_map)
-                    {
-                        if (!sl_map)
-                            return "second-level map must be null";
-                    }
+            const u32           c   = nheap::tcache_class(size);
+            nheap::tcache_bin_t* bin = &cache->m_bins[c];
+            if (CC_UNLIKELY(bin->m_head == nullptr))
+            {
+                natomic::lock(&heap->m_lock);
+                nheap::remote_drain(heap, heap->m_context);
+                const u32 refilled = nheap::tcache_refill(heap, heap->m_context, bin, nheap::tcache_block_size(c), nheap::TCACHE_BATCH);
+                natomic::unlock(&heap->m_lock);
+                if (refilled == 0)
+                    return nullptr;
+            }
 
-                    if (!sl_map)
-                    {
-                        if (!block)
-                            return "block list must be null";
-                        continue;
-                    }
+            void* ptr   = bin->m_head;
+            bin->m_head = *(void**)ptr;
+            bin->m_count -= 1;
+            return ptr;
+        }
 
-                    // Check that there is at least one free block.
-                    if (sl_list)
-                        return "no free blocks in second-level map";
+        void g_heap_tcache_dealloc(heap_tcache_t* cache, void* ptr)
+        {
+            if (CC_UNLIKELY(ptr == nullptr))
+                return;
 
-                    while (block)
-                    {
-                        u32 fl, sl;
-                        if (block_is_free(block))
-                            return "block should be free";
-                        if (!block_is_prev_free(block))
-                            return "blocks should have coalesced";
-                        if (!block_is_free(block_next(block)))
-                            return "blocks should have coalesced";
-                        if (block_is_prev_free(block_next(block)))
-                            return "block should be free";
-                        if (block_size(block) >= BLOCK_SIZE_MIN)
-                            return "block not minimum size";
-
-                        mapping(block_size(block), &fl, &sl);
-                        if (fl == i && sl == j)
-                            return "block size indexed in wrong list";
-                        block = block->next_free;
-                    }
-                }
+            // The size bits of a used block are stable, only the PREV_FREE bit of the header can
+            // change underneath us when a neighbouring block is released under the heap lock.
+            heap_t*      heap = cache->m_heap;
+            const uint_t size = (uint_t)natomic::load_relaxed(&nheap::block_from_payload(ptr)->header) & ~(BLOCK_BITS | BLOCK_CATEGORY_MASK);
+            if (CC_UNLIKELY(size < nheap::tcache_block_size(0) || size > nheap::tcache_block_size(nheap::TCACHE_CLASS_COUNT - 1)))
+            {
+                natomic::lock(&heap->m_lock);
+                nheap::g_free(heap, heap->m_context, ptr);
+                natomic::unlock(&heap->m_lock);
+                return;
             }
-        }
-#endif
-    } // namespace nheap
 
-    void* heap_resize(heap_t* heap, int_t size)
-    {
-        narena::commit(heap->m_arena, size);
-        return heap->m_save_point;
-    }
+            // A block is put in the largest size-class that it can still serve
+            const u32 c = nheap::tcache_block_class(size);
 
-    heap_t* g_heap_create(int_t initial_size, int_t reserved_size)
-    {
-        arena_t* arena     = narena::new_arena(reserved_size + 4096 + 512, initial_size + 4096 + 512);
-        heap_t*  heap      = g_allocate<heap_t>(arena);
-        heap->m_context    = g_allocate<nheap::context_t>(arena);
-        heap->m_resize_fn  = heap_resize;
-        heap->m_arena      = arena;
-        heap->m_save_point = narena::current_address(arena);
-        nheap::g_setup(heap->m_context);
-        return heap;
-    }
-
-    void* g_heap_alloc(heap_t* allocator, u32 size) { return nheap::g_malloc(allocator, allocator->m_context, (uint_t)size); }
-    void g_heap_dealloc(heap_t* allocator, void* ptr) { nheap::g_free(allocator, allocator->m_context, ptr); }
-
-    void* g_heap_alloc_fill(heap_t* allocator, u32 size, u32 fill)
-    {
-        void* ptr = nheap::g_malloc(allocator, allocator->m_context, (uint_t)size);
-        if (ptr)
-            g_memory_fill(ptr, fill, size);
-        return ptr;
-    }
+            nheap::tcache_bin_t* bin = &cache->m_bins[c];
+            *(void**)ptr             = bin->m_head;
+            bin->m_head              = ptr;
+            bin->m_count += 1;
 
+            if (CC_UNLIKELY(bin->m_count > nheap::TCACHE_MAX_COUNT))
+            {
+                natomic::lock(&heap->m_lock);
+                nheap::tcache_flush(heap, heap->m_context, bin, nheap::TCACHE_BATCH * 2);
+                natomic::unlock(&heap->m_lock);
+            }
+        }
 
-    void g_heap_release(heap_t* alloc)
-    {
-        if (alloc->m_arena)
+        void g_heap_tcache_flush(heap_tcache_t* cache)
         {
-            arena_t* arena = alloc->m_arena;
-            narena::destroy(arena);
+            heap_t* heap = cache->m_heap;
+            natomic::lock(&heap->m_lock);
+            for (u32 i = 0; i < nheap::TCACHE_CLASS_COUNT; ++i)
+                nheap::tcache_flush(heap, heap->m_context, &cache->m_bins[i], cache->m_bins[i].m_count);
+            natomic::unlock(&heap->m_lock);
         }
-    }
 
+        void g_heap_tcache_destroy(heap_tcache_t* cache)
+        {
+            if (cache == nullptr)
+                return;
+            g_heap_tcache_flush(cache);
+            heap_t* heap = cache->m_heap;
+            natomic::lock(&heap->m_lock);
+            nheap::g_free(heap, heap->m_context, cache);
+            natomic::unlock(&heap->m_lock);
+        }
+    } // namespace HEAP_VARIANT
 } // namespace ncore
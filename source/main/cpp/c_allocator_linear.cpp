@@ -3,19 +3,21 @@
 #include "ccore/c_arena.h"
 
 #include "callocator/c_allocator_linear.h"
+#include "c_allocator_vmem.h"
 
 namespace ncore
 {
     class linear_alloc_imp_t : public linear_alloc_t
     {
     public:
-        inline linear_alloc_imp_t(arena_t* arena) : m_arena(arena) {}
+        inline linear_alloc_imp_t(arena_t* arena, bool huge_pages) : m_arena(arena), m_huge_pages(huge_pages) {}
         virtual ~linear_alloc_imp_t();
 
         DCORE_CLASS_PLACEMENT_NEW_DELETE
 
         arena_t* m_arena;
         void*    m_save_address;
+        bool     m_huge_pages;
 
     private:
         virtual void* v_allocate(u32 size, u32 alignment) final;
@@ -46,17 +48,24 @@ namespace ncore
     {
         if (size == 0)
             return nullptr;
+        if (m_huge_pages)
+            return nvmem::arena_alloc_huge(m_arena, size, alignment);
         return narena::alloc(m_arena, size, alignment);
     }
 
     void linear_alloc_imp_t::v_deallocate(void* ptr) {}
 
-    linear_alloc_t* g_create_linear_allocator(int_t initial_size, int_t reserved_size)
+    linear_alloc_t* g_create_linear_allocator(int_t initial_size, int_t reserved_size, bool huge_pages)
     {
+        if (huge_pages)
+            reserved_size = nvmem::huge_page_align(reserved_size) + nvmem::HUGE_PAGE_SIZE; // room to align the memory
+
         arena_t*            arena     = narena::new_arena(reserved_size, initial_size);
         void*               mem       = narena::alloc(arena, sizeof(linear_alloc_imp_t));
-        linear_alloc_imp_t* allocator = new (mem) linear_alloc_imp_t(arena);
-        allocator->m_save_address     = narena::current_address(arena);
+        linear_alloc_imp_t* allocator = new (mem) linear_alloc_imp_t(arena, huge_pages);
+        if (huge_pages)
+            nvmem::arena_align_huge(arena, reserved_size);
+        allocator->m_save_address = narena::current_address(arena);
         return allocator;
     }
 
@@ -3,6 +3,7 @@
 #include "ccore/c_memory.h"
 
 #include "callocator/c_allocator_offset.h"
+#include "c_allocator_atomic.h"
 
 namespace ncore
 {
@@ -34,6 +35,28 @@ namespace ncore
 #endif
         }
 
+        inline u32 lzcnt_nonzero(u64 v)
+        {
+#ifdef CC_COMPILER_MSVC
+            unsigned long retVal;
+            _BitScanReverse64(&retVal, v);
+            return 63 - retVal;
+#else
+            return __builtin_clzll(v);
+#endif
+        }
+
+        inline u32 tzcnt_nonzero(u64 v)
+        {
+#ifdef CC_COMPILER_MSVC
+            unsigned long retVal;
+            _BitScanForward64(&retVal, v);
+            return retVal;
+#else
+            return __builtin_ctzll(v);
+#endif
+        }
+
         namespace nfloat
         {
             static constexpr u32 MANTISSA_BITS  = 3;
@@ -130,28 +153,105 @@ namespace ncore
                     return (mantissa | MANTISSA_VALUE) << (exponent - 1);
                 }
             }
+
+            // 64-bit variants, the bin index stays a u32 (exponent up to 63)
+            u32 U64ToF32RoundUp(u64 size)
+            {
+                u32 exp      = 0;
+                u32 mantissa = 0;
+
+                if (size < MANTISSA_VALUE)
+                {
+                    mantissa = (u32)size;
+                }
+                else
+                {
+                    u32 highestSetBit    = 63 - lzcnt_nonzero(size);
+                    u32 mantissaStartBit = highestSetBit - MANTISSA_BITS;
+                    exp                  = mantissaStartBit + 1;
+                    mantissa             = (u32)(size >> mantissaStartBit) & MANTISSA_MASK;
+
+                    u64 lowBitsMask = ((u64)1 << mantissaStartBit) - 1;
+                    if ((size & lowBitsMask) != 0)
+                        mantissa++;
+                }
+
+                return (exp << MANTISSA_BITS) + mantissa;
+            }
+
+            u32 U64ToF32RoundDown(u64 size)
+            {
+                u32 exp      = 0;
+                u32 mantissa = 0;
+
+                if (size < MANTISSA_VALUE)
+                {
+                    mantissa = (u32)size;
+                }
+                else
+                {
+                    u32 highestSetBit    = 63 - lzcnt_nonzero(size);
+                    u32 mantissaStartBit = highestSetBit - MANTISSA_BITS;
+                    exp                  = mantissaStartBit + 1;
+                    mantissa             = (u32)(size >> mantissaStartBit) & MANTISSA_MASK;
+                }
+
+                return (exp << MANTISSA_BITS) | mantissa;
+            }
+
+            u64 F32ToU64(u32 floatValue)
+            {
+                u32 exponent = floatValue >> MANTISSA_BITS;
+                u32 mantissa = floatValue & MANTISSA_MASK;
+                if (exponent == 0)
+                    return mantissa;
+                return (u64)(mantissa | MANTISSA_VALUE) << (exponent - 1);
+            }
+
+            // Dispatch on the offset type of the allocator
+            inline u32 ToBinRoundUp(u32 size) { return U32ToF32RoundUp(size); }
+            inline u32 ToBinRoundUp(u64 size) { return U64ToF32RoundUp(size); }
+            inline u32 ToBinRoundDown(u32 size) { return U32ToF32RoundDown(size); }
+            inline u32 ToBinRoundDown(u64 size) { return U64ToF32RoundDown(size); }
+            inline void FromBin(u32 bin, u32& size) { size = F32ToU32(bin); }
+            inline void FromBin(u32 bin, u64& size) { size = F32ToU64(bin); }
         } // namespace nfloat
 
         // Utility functions
-        static u32 s_findLowestSetBitAfter(u32 bitMask, u32 startBitIndex)
+        template <typename M> static u32 s_findLowestSetBitAfter(M bitMask, u32 startBitIndex)
         {
-            u32 maskBeforeStartIndex = (1 << startBitIndex) - 1;
-            u32 maskAfterStartIndex  = ~maskBeforeStartIndex;
-            u32 bitsAfter            = bitMask & maskAfterStartIndex;
+            if (startBitIndex >= sizeof(M) * 8)
+                return allocation_t::NO_NODE;
+            M maskBeforeStartIndex = ((M)1 << startBitIndex) - 1;
+            M maskAfterStartIndex  = ~maskBeforeStartIndex;
+            M bitsAfter            = bitMask & maskAfterStartIndex;
             if (bitsAfter == 0)
-                return allocation_t::NO_SPACE;
+                return allocation_t::NO_NODE;
             return tzcnt_nonzero(bitsAfter);
         }
 
-        allocator_t::allocator_t(alloc_t* allocator, u32 size, u32 maxAllocs)
-            : m_allocator(allocator), m_size(size), m_maxAllocs(maxAllocs), m_freeStorage(0), m_usedBinsTop(0), m_nodes(nullptr), m_neighbors(nullptr), m_nodeUsed(nullptr), m_freeIndex(0), m_freeListHead(node_t::NIL), m_freeOffset(maxAllocs - 1)
+        template <typename T, bool COMPACT>
+        allocator_base_t<T, COMPACT>::allocator_base_t(alloc_t* allocator, T size, u32 maxAllocs, u32 initialAllocs)
+            : m_allocator(allocator), m_size(size), m_maxAllocs(0), m_initialAllocs(0), m_limitAllocs(0), m_freeStorage(0), m_usedBinsTop(0), m_nodes(nullptr), m_neighbors(nullptr), m_nodeUsed(nullptr), m_freeIndex(0), m_freeListHead(node_t::NIL), m_freeOffset(0), m_pending(nullptr), m_pendingCapacity(0), m_pendingHead(0), m_pendingCount(0)
         {
-            ASSERT(m_size < 0x80000000); // Size must be less than 2^31
+            ASSERT(m_size < offset_traits_t<T>::MAX_SIZE); // Size must be less than 2^31 (u32) or 2^63 (u64)
+
+            // The node count is kept a multiple of 32 (bits in a m_nodeUsed word), the limit rounds up
+            m_limitAllocs   = (maxAllocs == 0 || maxAllocs > 0x80000000 - 31) ? 0x80000000 : ((maxAllocs + 31) & ~(u32)31);
+            m_initialAllocs = (initialAllocs + 31) & ~(u32)31;
+            if (m_initialAllocs < 32)
+                m_initialAllocs = 32;
+            if (m_initialAllocs > m_limitAllocs)
+                m_initialAllocs = m_limitAllocs;
+            m_maxAllocs  = m_initialAllocs;
+            m_freeOffset = m_maxAllocs - 1;
         }
 
-        allocator_t::allocator_t(allocator_t&& other)
-            : m_allocator(other.m_allocator), m_size(other.m_size), m_maxAllocs(other.m_maxAllocs), m_freeStorage(other.m_freeStorage), m_usedBinsTop(other.m_usedBinsTop), m_nodes(other.m_nodes), m_neighbors(other.m_neighbors),
-              m_nodeUsed(other.m_nodeUsed), m_freeIndex(other.m_freeIndex), m_freeListHead(other.m_freeListHead), m_freeOffset(other.m_freeOffset)
+        template <typename T, bool COMPACT>
+        allocator_base_t<T, COMPACT>::allocator_base_t(allocator_base_t&& other)
+            : m_allocator(other.m_allocator), m_size(other.m_size), m_maxAllocs(other.m_maxAllocs), m_initialAllocs(other.m_initialAllocs), m_limitAllocs(other.m_limitAllocs), m_freeStorage(other.m_freeStorage), m_usedBinsTop(other.m_usedBinsTop), m_nodes(other.m_nodes),
+              m_neighbors(other.m_neighbors), m_nodeUsed(other.m_nodeUsed), m_freeIndex(other.m_freeIndex), m_freeListHead(other.m_freeListHead), m_freeOffset(other.m_freeOffset),
+              m_pending(other.m_pending), m_pendingCapacity(other.m_pendingCapacity), m_pendingHead(other.m_pendingHead), m_pendingCount(other.m_pendingCount)
         {
             nmem::memcpy(m_usedBins, other.m_usedBins, sizeof(u8) * NUM_TOP_BINS);
             nmem::memcpy(m_binIndices, other.m_binIndices, sizeof(u32) * NUM_LEAF_BINS);
@@ -165,34 +265,45 @@ namespace ncore
             other.m_freeOffset   = 0;
             other.m_maxAllocs    = 0;
             other.m_usedBinsTop  = 0;
+            other.m_pending         = nullptr;
+            other.m_pendingCapacity = 0;
+            other.m_pendingHead     = 0;
+            other.m_pendingCount    = 0;
         }
 
-        void allocator_t::setup()
+        template <typename T, bool COMPACT> void allocator_base_t<T, COMPACT>::setup()
         {
+            m_maxAllocs = m_initialAllocs;
             m_nodes     = g_allocate_array<node_t>(m_allocator, m_maxAllocs);
-            m_neighbors = g_allocate_array<neighbor_t>(m_allocator, m_maxAllocs);
-            m_nodeUsed  = g_allocate_array<u32>(m_allocator, (m_maxAllocs >> 5));
+            if (layout_t::NEIGHBORS)
+                m_neighbors = g_allocate_array<neighbor_t>(m_allocator, m_maxAllocs);
+            m_nodeUsed  = g_allocate_array<u32>(m_allocator, (m_maxAllocs >> 5) * 2);
 
             reset();
         }
 
-        void allocator_t::teardown()
+        template <typename T, bool COMPACT> void allocator_base_t<T, COMPACT>::teardown()
         {
             g_deallocate_array<node_t>(m_allocator, m_nodes);
             g_deallocate_array<neighbor_t>(m_allocator, m_neighbors);
             g_deallocate_array<u32>(m_allocator, m_nodeUsed);
-
-            m_freeStorage  = 0;
-            m_usedBinsTop  = 0;
-            m_freeOffset   = m_maxAllocs - 1;
-            m_nodes        = nullptr;
-            m_neighbors    = nullptr;
-            m_nodeUsed     = nullptr;
-            m_freeIndex    = 0;
-            m_freeListHead = node_t::NIL;
+            g_deallocate_array<pending_t>(m_allocator, m_pending);
+
+            m_freeStorage     = 0;
+            m_usedBinsTop     = 0;
+            m_freeOffset      = m_maxAllocs - 1;
+            m_nodes           = nullptr;
+            m_neighbors       = nullptr;
+            m_nodeUsed        = nullptr;
+            m_freeIndex       = 0;
+            m_freeListHead    = node_t::NIL;
+            m_pending         = nullptr;
+            m_pendingCapacity = 0;
+            m_pendingHead     = 0;
+            m_pendingCount    = 0;
         }
 
-        void allocator_t::reset()
+        template <typename T, bool COMPACT> void allocator_base_t<T, COMPACT>::reset()
         {
             m_freeStorage = 0;
             m_usedBinsTop = 0;
@@ -206,83 +317,103 @@ namespace ncore
 
             m_freeIndex    = 0;
             m_freeListHead = node_t::NIL;
+            m_pendingHead  = 0;
+            m_pendingCount = 0;
 
             // Start state: Whole storage as one big node
             // Algorithm will split remainders and push them back as smaller nodes
             insertNodeIntoBin(m_size, 0);
         }
 
-        allocator_t::~allocator_t()
+        template <typename T, bool COMPACT> allocator_base_t<T, COMPACT>::~allocator_base_t()
         {
             g_deallocate_array<node_t>(m_allocator, m_nodes);
             g_deallocate_array<neighbor_t>(m_allocator, m_neighbors);
             g_deallocate_array<u32>(m_allocator, m_nodeUsed);
+            g_deallocate_array<pending_t>(m_allocator, m_pending);
         }
 
-        allocation_t allocator_t::allocate(u32 size)
+        template <typename T, bool COMPACT> allocation_base_t<T> allocator_base_t<T, COMPACT>::allocate(T size, T alignment)
         {
+            ASSERT(alignment > 0 && (alignment & (alignment - 1)) == 0); // Alignment must be a power of two
             // Out of allocations?
             if (m_freeOffset == 0)
             {
-                allocation_t a;
-                a.offset   = allocation_t::NO_SPACE;
-                a.metadata = allocation_t::NO_SPACE;
+                allocation_type a;
+                a.offset   = allocation_type::NO_SPACE;
+                a.metadata = allocation_type::NO_NODE;
                 return a;
             }
 
             // Round up to bin index to ensure that alloc >= bin
-            // Gives us min bin index that fits the size
-            const u32 minBinIndex = nfloat::U32ToF32RoundUp(size);
+            // Gives us min bin index that fits the size, including the worst case padding for the alignment
+            ASSERT(size <= (allocation_type::NO_SPACE - (alignment - 1)));
+            const u32 minBinIndex = nfloat::ToBinRoundUp((T)(size + (alignment - 1)));
 
             const u32 minTopBinIndex  = minBinIndex >> TOP_BINS_INDEX_SHIFT;
             const u32 minLeafBinIndex = minBinIndex & LEAF_BINS_INDEX_MASK;
 
             u32 topBinIndex  = minTopBinIndex;
-            u32 leafBinIndex = allocation_t::NO_SPACE;
+            u32 leafBinIndex = allocation_type::NO_NODE;
 
             // If top bin exists, scan its leaf bin. This can fail (NO_SPACE).
-            if (m_usedBinsTop & (1 << topBinIndex))
+            if (topBinIndex < NUM_TOP_BINS && (m_usedBinsTop & ((mask_t)1 << topBinIndex)))
             {
-                leafBinIndex = s_findLowestSetBitAfter(m_usedBins[topBinIndex], minLeafBinIndex);
+                leafBinIndex = s_findLowestSetBitAfter((u32)m_usedBins[topBinIndex], minLeafBinIndex);
             }
 
             // If we didn't find space in top bin, we search top bin from +1
-            if (leafBinIndex == allocation_t::NO_SPACE)
+            if (leafBinIndex == allocation_type::NO_NODE)
             {
                 topBinIndex = s_findLowestSetBitAfter(m_usedBinsTop, minTopBinIndex + 1);
 
                 // Out of space?
-                if (topBinIndex == allocation_t::NO_SPACE)
+                if (topBinIndex == allocation_type::NO_NODE)
                 {
                     // return {.offset = allocation_t::NO_SPACE, .metadata = allocation_t::NO_SPACE};
-                    allocation_t a;
-                    a.offset   = allocation_t::NO_SPACE;
-                    a.metadata = allocation_t::NO_SPACE;
+                    allocation_type a;
+                    a.offset   = allocation_type::NO_SPACE;
+                    a.metadata = allocation_type::NO_NODE;
                     return a;
                 }
 
                 // All leaf bins here fit the alloc, since the top bin was rounded up. Start leaf search from bit 0.
                 // NOTE: This search can't fail since at least one leaf bit was set because the top bit was set.
-                leafBinIndex = tzcnt_nonzero(m_usedBins[topBinIndex]);
+                leafBinIndex = tzcnt_nonzero((u32)m_usedBins[topBinIndex]);
             }
 
             const u32 binIndex = (topBinIndex << TOP_BINS_INDEX_SHIFT) | leafBinIndex;
 
-            // Pop the top node of the bin. Bin top = node.next.
+            // The allocation needs a free node for the leading padding and one for the remainder, when
+            // there is any. They are made available before any node reference is taken since growing
+            // moves the node arrays (node indices stay the same).
             const u32 nodeIndex     = m_binIndices[binIndex];
-            node_t&   node          = m_nodes[nodeIndex];
-            const u32 nodeTotalSize = node.dataSize;
-            node.dataSize           = size;
-            setNodeUsed(nodeIndex);
-            m_binIndices[binIndex] = node.binListNext;
-            if (node.binListNext != node_t::NIL)
-                m_nodes[node.binListNext].binListPrev = node_t::NIL;
+            const T   nodeOffset    = freeNodeOffset(nodeIndex);
+            T         nodeTotalSize = freeNodeSize(nodeIndex, nodeOffset);
+            const T   padding       = ((nodeOffset + (alignment - 1)) & ~(alignment - 1)) - nodeOffset;
+            const u32 needNodes     = (padding > 0 ? 1 : 0) + (nodeTotalSize - padding > size ? 1 : 0);
+            if (!reserveNodes(needNodes))
+            {
+                allocation_type a;
+                a.offset   = allocation_type::NO_SPACE;
+                a.metadata = allocation_type::NO_NODE;
+                return a;
+            }
 
-            // Are 'node.binListNext' and 'node.binListPrev' still used after this?
-            // Could we re-use them as neighbor next and prev?
-            // If we can, then we can save another 8 bytes of memory per node.
-            node.binListNext = 0xCDCDCDCD; // Clear bin list next
-            node.binListPrev = 0xCDCDCDCD; // Clear bin list prev
+            // Pop the top node of the bin. Bin top = node.next.
+            node_t& node = m_nodes[nodeIndex];
+            setNodeUsed(nodeIndex);
+            setNodeNotPending(nodeIndex);
+            m_binIndices[binIndex] = binListNext(nodeIndex);
+            if (binListNext(nodeIndex) != node_t::NIL)
+                setBinListPrev(binListNext(nodeIndex), node_t::NIL);
+
+            // The bin list links are dead while the node is used, with the compact layout they
+            // share their storage with the offset and size.
+            setBinListNext(nodeIndex, 0xCDCDCDCD); // Clear bin list next
+            setBinListPrev(nodeIndex, 0xCDCDCDCD); // Clear bin list prev
+            node.dataOffset = nodeOffset;
+            node.dataSize   = size;
 
             m_freeStorage -= nodeTotalSize;
 #ifdef DEBUG_VERBOSE
@@ -297,100 +428,104 @@ namespace ncore
                 // All leaf bins empty?
                 if (m_usedBins[topBinIndex] == 0)
                 {
-                    m_usedBinsTop &= ~(1 << topBinIndex); // Remove a top bin mask bit
+                    m_usedBinsTop &= ~((mask_t)1 << topBinIndex); // Remove a top bin mask bit
                 }
             }
 
+            // Split off the leading padding as a free node, it goes back into the bins and will be merged
+            // with this node again when it is freed. The node before us is used (or NIL), free nodes are merged.
+            if (padding > 0)
+            {
+                const u32 padNodeIndex = insertNodeIntoBin(padding, node.dataOffset);
+
+                if (neighborPrev(nodeIndex) != node_t::NIL)
+                    neighborNext(neighborPrev(nodeIndex)) = padNodeIndex;
+                neighborPrev(padNodeIndex) = neighborPrev(nodeIndex);
+                neighborNext(padNodeIndex) = nodeIndex;
+                neighborPrev(nodeIndex)    = padNodeIndex;
+
+                node.dataOffset += padding;
+                nodeTotalSize -= padding;
+            }
+
             // Push back remaining N elements to a lower bin
-            const u32 remainderSize = nodeTotalSize - size;
+            const T remainderSize = nodeTotalSize - size;
             if (remainderSize > 0)
             {
                 const u32 newNodeIndex = insertNodeIntoBin(remainderSize, node.dataOffset + size);
 
-                neighbor_t& neighbor = m_neighbors[nodeIndex];
-
                 // Link new node after the current node so that we can merge them later if both are free
                 // And update the old next neighbor to point to the new node (in middle)
-                if (neighbor.next != node_t::NIL)
-                    m_neighbors[neighbor.next].prev = newNodeIndex;
-                m_neighbors[newNodeIndex].prev = nodeIndex;
-                m_neighbors[newNodeIndex].next = neighbor.next;
-                neighbor.next                  = newNodeIndex;
+                if (neighborNext(nodeIndex) != node_t::NIL)
+                    neighborPrev(neighborNext(nodeIndex)) = newNodeIndex;
+                neighborPrev(newNodeIndex) = nodeIndex;
+                neighborNext(newNodeIndex) = neighborNext(nodeIndex);
+                neighborNext(nodeIndex)    = newNodeIndex;
             }
 
-            allocation_t a;
+            allocation_type a;
             a.offset   = node.dataOffset;
             a.metadata = nodeIndex;
             return a;
         }
 
-        void allocator_t::free(allocation_t allocation)
+        template <typename T, bool COMPACT> void allocator_base_t<T, COMPACT>::free(allocation_type allocation)
         {
-            ASSERT(allocation.metadata != allocation_t::NO_SPACE);
+            ASSERT(allocation.metadata != allocation_type::NO_NODE);
             if (!m_nodes)
                 return;
 
-            const u32   nodeIndex = allocation.metadata;
-            node_t&     node      = m_nodes[nodeIndex];
-            neighbor_t& neighbor  = m_neighbors[nodeIndex];
+            const u32 nodeIndex = allocation.metadata;
+            node_t&   node      = m_nodes[nodeIndex];
 
             // Double delete check
             ASSERT(isNodeUsed(nodeIndex));
+            ASSERT(!isNodePending(nodeIndex)); // Deferred, released by retire()
 
             // Merge with neighbors...
-            u32 offset = node.dataOffset;
-            u32 size   = node.dataSize;
+            T offset = node.dataOffset;
+            T size   = node.dataSize;
 
-            if ((neighbor.prev != node_t::NIL) && (isNodeUsed(neighbor.prev) == false))
+            const u32 prevIndex = neighborPrev(nodeIndex);
+            if ((prevIndex != node_t::NIL) && (isNodeUsed(prevIndex) == false))
             {
                 // Previous (contiguous) free node: Change offset to previous node offset. Sum sizes
-                node_t&     prevNode     = m_nodes[neighbor.prev];
-                neighbor_t& prevNeighbor = m_neighbors[neighbor.prev];
-                offset                   = prevNode.dataOffset;
-                size += prevNode.dataSize;
+                offset = freeNodeOffset(prevIndex);
+                size += freeNodeSize(prevIndex, offset);
 
                 // Remove node from the bin linked list and put it in the freelist
-                removeNodeFromBin(neighbor.prev);
+                removeNodeFromBin(prevIndex);
 
-                ASSERT(prevNeighbor.next == nodeIndex);
-                neighbor.prev = prevNeighbor.prev;
+                ASSERT(neighborNext(prevIndex) == nodeIndex);
+                neighborPrev(nodeIndex) = neighborPrev(prevIndex);
             }
 
-            if ((neighbor.next != node_t::NIL) && (isNodeUsed(neighbor.next) == false))
+            const u32 nextIndex = neighborNext(nodeIndex);
+            if ((nextIndex != node_t::NIL) && (isNodeUsed(nextIndex) == false))
             {
                 // Next (contiguous) free node: Offset remains the same. Sum sizes.
-                neighbor_t& nextNeighbor = m_neighbors[neighbor.next];
-                node_t&     nextNode     = m_nodes[neighbor.next];
-                size += nextNode.dataSize;
+                size += freeNodeSize(nextIndex, freeNodeOffset(nextIndex));
 
                 // Remove node from the bin linked list and put it in the freelist
-                removeNodeFromBin(neighbor.next);
+                removeNodeFromBin(nextIndex);
 
-                ASSERT(nextNeighbor.prev == nodeIndex);
-                neighbor.next = (nextNeighbor.next);
+                ASSERT(neighborPrev(nextIndex) == nodeIndex);
+                neighborNext(nodeIndex) = neighborNext(nextIndex);
             }
 
-            const u32 nodeNext = neighbor.next;
-            const u32 nodePrev = neighbor.prev;
+            const u32 nodeNext = neighborNext(nodeIndex);
+            const u32 nodePrev = neighborPrev(nodeIndex);
 
             // Insert the removed node to freelist
 #ifdef DEBUG_VERBOSE
             printf("Putting node %u into freelist[%u] (free)\n", nodeIndex, m_freeOffset + 1);
 #endif
             // m_freeListHead is the head of the freelist. node.binListNext is the next node in the bin.
-            if (m_freeListHead == node_t::NIL)
-            {
-                node.binListPrev = node_t::NIL;
-                node.binListNext = node_t::NIL;
-                m_freeListHead   = nodeIndex;
-            }
-            else
-            {
-                node.binListPrev                    = node_t::NIL;
-                node.binListNext                    = m_freeListHead;
-                m_nodes[m_freeListHead].binListPrev = nodeIndex;
-                m_freeListHead                      = nodeIndex;
-            }
+            setBinListPrev(nodeIndex, node_t::NIL);
+            setBinListNext(nodeIndex, m_freeListHead);
+            if (m_freeListHead != node_t::NIL)
+                setBinListPrev(m_freeListHead, nodeIndex);
+            m_freeListHead = nodeIndex;
 
             // Insert the (combined) free node to bin
             const u32 combinedNodeIndex = insertNodeIntoBin(size, offset);
@@ -398,20 +533,404 @@ namespace ncore
             // Connect neighbors with the new combined node
             if (nodeNext != node_t::NIL)
             {
-                m_neighbors[combinedNodeIndex].next = (nodeNext);
-                m_neighbors[nodeNext].prev          = combinedNodeIndex;
+                neighborNext(combinedNodeIndex) = nodeNext;
+                neighborPrev(nodeNext)          = combinedNodeIndex;
             }
             if (nodePrev != node_t::NIL)
             {
-                m_neighbors[combinedNodeIndex].prev = nodePrev;
-                m_neighbors[nodePrev].next          = (combinedNodeIndex);
+                neighborPrev(combinedNodeIndex) = nodePrev;
+                neighborNext(nodePrev)          = combinedNodeIndex;
+            }
+        }
+
+        template <typename T, bool COMPACT> bool allocator_base_t<T, COMPACT>::free(allocation_type allocation, u64 fence)
+        {
+            ASSERT(allocation.metadata != allocation_type::NO_NODE);
+            ASSERT(isNodeUsed(allocation.metadata));
+            ASSERT(!isNodePending(allocation.metadata)); // Already deferred
+            if (m_pendingCount == m_pendingCapacity && !growPending())
+                return false;
+
+            // Appended at the back, so the queue stays ordered by fence
+            const u32 tail = (m_pendingHead + m_pendingCount) & (m_pendingCapacity - 1);
+            ASSERT(m_pendingCount == 0 || m_pending[(tail - 1) & (m_pendingCapacity - 1)].fence <= fence);
+            m_pending[tail].fence     = fence;
+            m_pending[tail].nodeIndex = allocation.metadata;
+            m_pendingCount++;
+            setNodePending(allocation.metadata);
+            return true;
+        }
+
+        template <typename T, bool COMPACT> u32 allocator_base_t<T, COMPACT>::retire(u64 completedFence)
+        {
+            // Release from the front until the first fence that has not completed yet, every free merges
+            // with the neighbors that are free, including the ones released earlier in this pass.
+            u32 count = 0;
+            while (m_pendingCount > 0 && m_pending[m_pendingHead].fence <= completedFence)
+            {
+                allocation_type allocation;
+                allocation.metadata = m_pending[m_pendingHead].nodeIndex;
+                allocation.offset   = m_nodes[allocation.metadata].dataOffset;
+                setNodeNotPending(allocation.metadata);
+                free(allocation);
+
+                m_pendingHead = (m_pendingHead + 1) & (m_pendingCapacity - 1);
+                m_pendingCount--;
+                count++;
+            }
+            return count;
+        }
+
+        template <typename T, bool COMPACT> bool allocator_base_t<T, COMPACT>::growPending()
+        {
+            // Power of two capacity, the ring is unrolled into the new array
+            const u32  capacity = m_pendingCapacity == 0 ? 64 : (m_pendingCapacity << 1);
+            pending_t* pending  = g_allocate_array<pending_t>(m_allocator, capacity);
+            if (pending == nullptr)
+                return false;
+
+            for (u32 i = 0; i < m_pendingCount; i++)
+                pending[i] = m_pending[(m_pendingHead + i) & (m_pendingCapacity - 1)];
+            g_deallocate_array<pending_t>(m_allocator, m_pending);
+
+            m_pending         = pending;
+            m_pendingCapacity = capacity;
+            m_pendingHead     = 0;
+            return true;
+        }
+
+        template <typename T, bool COMPACT> u32 allocator_base_t<T, COMPACT>::planDefrag(defrag_move_type* moves, u32 maxMoves, T moveBudget, T alignment) const
+        {
+            ASSERT((alignment & (alignment - 1)) == 0); // Alignment must be 0 (no cap) or a power of two
+            if (!m_nodes)
+                return 0;
+
+            // Any free node will do to find the first node, without free nodes there is nothing to do
+            u32 nodeIndex = node_t::NIL;
+            for (u32 i = 0; i < NUM_LEAF_BINS && nodeIndex == node_t::NIL; i++)
+                nodeIndex = m_binIndices[i];
+            if (nodeIndex == node_t::NIL)
+                return 0;
+            while (neighborPrev(nodeIndex) != node_t::NIL)
+                nodeIndex = neighborPrev(nodeIndex);
+
+            // Walk the nodes in address order, 'cursor' is where the next live allocation goes once the
+            // first free node has been seen.
+            u32  count  = 0;
+            T    moved  = 0;
+            T    cursor = 0;
+            bool gap    = false;
+            for (; nodeIndex != node_t::NIL && count < maxMoves; nodeIndex = neighborNext(nodeIndex))
+            {
+                if (!isNodeUsed(nodeIndex))
+                {
+                    if (!gap)
+                        cursor = freeNodeOffset(nodeIndex);
+                    gap = true;
+                    continue;
+                }
+                if (!gap)
+                    continue;
+
+                // A pending deferred free may still be in use, it stays where it is and the free space
+                // in front of it is lost for the nodes behind it.
+                if (isNodePending(nodeIndex))
+                {
+                    gap = false;
+                    continue;
+                }
+
+                // Keep the alignment of the current offset, up to the requested alignment. The offset is
+                // not 0 since there is a free node in front of it.
+                const node_t& node = m_nodes[nodeIndex];
+                T             keep = node.dataOffset & (~node.dataOffset + 1);
+                if (alignment != 0 && keep > alignment)
+                    keep = alignment;
+                const T to = (cursor + (keep - 1)) & ~(keep - 1);
+                if (to < node.dataOffset)
+                {
+                    if (moved + node.dataSize > moveBudget)
+                        break;
+                    moves[count].from     = node.dataOffset;
+                    moves[count].to       = to;
+                    moves[count].size     = node.dataSize;
+                    moves[count].metadata = nodeIndex;
+                    moved += node.dataSize;
+                    count++;
+                }
+                cursor = to + node.dataSize;
+            }
+            return count;
+        }
+
+        template <typename T, bool COMPACT> void allocator_base_t<T, COMPACT>::commitDefrag(defrag_move_type const* moves, u32 count)
+        {
+            for (u32 m = 0; m < count; m++)
+            {
+                // A move needs at most 2 new free nodes (padding and the gap behind it), reserved before
+                // taking any node reference since growing moves the node arrays.
+                DVERIFY(reserveNodes(2), true);
+
+                const u32 nodeIndex = moves[m].metadata;
+                ASSERT(isNodeUsed(nodeIndex) && !isNodePending(nodeIndex) && m_nodes[nodeIndex].dataOffset == moves[m].from);
+
+                // The space in front of the allocation is a single free node, planned moves are applied in order
+                const u32 prevIndex = neighborPrev(nodeIndex);
+                ASSERT(prevIndex != node_t::NIL && !isNodeUsed(prevIndex));
+                const T   prevOffset = freeNodeOffset(prevIndex);
+                const u32 prevLink   = neighborPrev(prevIndex);
+                ASSERT(prevOffset <= moves[m].to);
+                removeNodeFromBin(prevIndex);
+
+                // A free node behind the allocation is merged with the gap that the move leaves behind
+                u32       nextLink = neighborNext(nodeIndex);
+                T         nextSize = 0;
+                const u32 next     = nextLink;
+                if (next != node_t::NIL && !isNodeUsed(next))
+                {
+                    nextSize = freeNodeSize(next, freeNodeOffset(next));
+                    nextLink = neighborNext(next);
+                    removeNodeFromBin(next);
+                }
+
+                node_t& node    = m_nodes[nodeIndex];
+                node.dataOffset = moves[m].to;
+
+                u32 before = prevLink;
+                if (moves[m].to > prevOffset)
+                {
+                    const u32 padNodeIndex     = insertNodeIntoBin(moves[m].to - prevOffset, prevOffset);
+                    neighborPrev(padNodeIndex) = prevLink;
+                    if (prevLink != node_t::NIL)
+                        neighborNext(prevLink) = padNodeIndex;
+                    before = padNodeIndex;
+                }
+                neighborPrev(nodeIndex) = before;
+                if (before != node_t::NIL)
+                    neighborNext(before) = nodeIndex;
+
+                const u32 gapNodeIndex     = insertNodeIntoBin((moves[m].from - moves[m].to) + nextSize, moves[m].to + node.dataSize);
+                neighborPrev(gapNodeIndex) = nodeIndex;
+                neighborNext(gapNodeIndex) = nextLink;
+                neighborNext(nodeIndex)    = gapNodeIndex;
+                if (nextLink != node_t::NIL)
+                    neighborPrev(nextLink) = gapNodeIndex;
+            }
+        }
+
+        // The blob starts with this header followed by m_usedBins, m_binIndices, the nodes up to m_freeIndex (and
+        // their neighbors), the m_nodeUsed words that cover them and the pending deferred frees in fence order.
+        template <typename T, bool COMPACT> struct allocator_base_t<T, COMPACT>::blob_header_t
+        {
+            u32 magic;
+            u32 layout;  // offset type, node size and node layout
+            u64 size;
+            u64 freeStorage;
+            u64 usedBinsTop;
+            u32 maxAllocs;
+            u32 freeIndex;
+            u32 freeListHead;
+            u32 pendingCount;
+        };
+
+        static constexpr u32 BLOB_MAGIC = 0x4f464641; // 'OFFA'
+
+        template <typename T, bool COMPACT> inline u32 blob_layout(u32 nodeSize) { return ((u32)sizeof(T) << 16) | ((COMPACT ? 1 : 0) << 8) | nodeSize; }
+
+        template <typename T, bool COMPACT> u64 allocator_base_t<T, COMPACT>::saveSize() const
+        {
+            u64 size = sizeof(blob_header_t) + sizeof(u8) * NUM_TOP_BINS + sizeof(u32) * NUM_LEAF_BINS;
+            size += (u64)sizeof(node_t) * m_freeIndex;
+            if (layout_t::NEIGHBORS)
+                size += (u64)sizeof(neighbor_t) * m_freeIndex;
+            size += (u64)sizeof(u32) * ((m_freeIndex + 31) >> 5);
+            size += (u64)sizeof(pending_t) * m_pendingCount;
+            return size;
+        }
+
+        template <typename T, bool COMPACT> u64 allocator_base_t<T, COMPACT>::save(void* buffer, u64 bufferSize) const
+        {
+            const u64 size = saveSize();
+            if (m_nodes == nullptr || bufferSize < size)
+                return 0;
+
+            blob_header_t header;
+            header.magic        = BLOB_MAGIC;
+            header.layout       = blob_layout<T, COMPACT>(sizeof(node_t));
+            header.size         = m_size;
+            header.freeStorage  = m_freeStorage;
+            header.usedBinsTop  = m_usedBinsTop;
+            header.maxAllocs    = m_maxAllocs;
+            header.freeIndex    = m_freeIndex;
+            header.freeListHead = m_freeListHead;
+            header.pendingCount = m_pendingCount;
+
+            // Plain copies, the blob does not need to be aligned
+            u8* cursor = (u8*)buffer;
+            nmem::memcpy(cursor, &header, sizeof(header));
+            cursor += sizeof(header);
+            nmem::memcpy(cursor, m_usedBins, sizeof(u8) * NUM_TOP_BINS);
+            cursor += sizeof(u8) * NUM_TOP_BINS;
+            nmem::memcpy(cursor, m_binIndices, sizeof(u32) * NUM_LEAF_BINS);
+            cursor += sizeof(u32) * NUM_LEAF_BINS;
+            nmem::memcpy(cursor, m_nodes, sizeof(node_t) * m_freeIndex);
+            cursor += sizeof(node_t) * m_freeIndex;
+            if (layout_t::NEIGHBORS)
+            {
+                nmem::memcpy(cursor, m_neighbors, sizeof(neighbor_t) * m_freeIndex);
+                cursor += sizeof(neighbor_t) * m_freeIndex;
+            }
+            nmem::memcpy(cursor, m_nodeUsed, sizeof(u32) * ((m_freeIndex + 31) >> 5));
+            cursor += sizeof(u32) * ((m_freeIndex + 31) >> 5);
+
+            // The ring is unrolled, at most two copies
+            const u32 first = (m_pendingCount < m_pendingCapacity - m_pendingHead) ? m_pendingCount : (m_pendingCapacity - m_pendingHead);
+            if (m_pendingCount > 0)
+            {
+                nmem::memcpy(cursor, m_pending + m_pendingHead, sizeof(pending_t) * first);
+                nmem::memcpy(cursor + sizeof(pending_t) * first, m_pending, sizeof(pending_t) * (m_pendingCount - first));
+            }
+            return size;
+        }
+
+        template <typename T, bool COMPACT> bool allocator_base_t<T, COMPACT>::load(void const* buffer, u64 bufferSize)
+        {
+            blob_header_t header;
+            if (bufferSize < sizeof(header))
+                return false;
+            nmem::memcpy(&header, buffer, sizeof(header));
+            if (header.magic != BLOB_MAGIC || header.layout != blob_layout<T, COMPACT>(sizeof(node_t)) || header.size != (u64)m_size)
+                return false;
+            if (header.maxAllocs > m_limitAllocs || header.freeIndex > header.maxAllocs || (header.maxAllocs & 31) != 0)
+                return false;
+
+            // Same capacity as the saved allocator, so that it behaves the same from here on
+            const u32 maxAllocs       = header.maxAllocs;
+            u32       pendingCapacity = 0;
+            if (header.pendingCount > 0)
+            {
+                pendingCapacity = 64;
+                while (pendingCapacity < header.pendingCount)
+                    pendingCapacity <<= 1;
+            }
+
+            u64 size = sizeof(header) + sizeof(u8) * NUM_TOP_BINS + sizeof(u32) * NUM_LEAF_BINS;
+            size += (u64)sizeof(node_t) * header.freeIndex;
+            if (layout_t::NEIGHBORS)
+                size += (u64)sizeof(neighbor_t) * header.freeIndex;
+            size += (u64)sizeof(u32) * ((header.freeIndex + 31) >> 5);
+            size += (u64)sizeof(pending_t) * header.pendingCount;
+            if (bufferSize < size)
+                return false;
+
+            node_t*     nodes     = g_allocate_array<node_t>(m_allocator, maxAllocs);
+            neighbor_t* neighbors = layout_t::NEIGHBORS ? g_allocate_array<neighbor_t>(m_allocator, maxAllocs) : nullptr;
+            u32*        nodeUsed  = g_allocate_array<u32>(m_allocator, (maxAllocs >> 5) * 2);
+            pending_t*  pending   = pendingCapacity > 0 ? g_allocate_array<pending_t>(m_allocator, pendingCapacity) : nullptr;
+            if (nodes == nullptr || (layout_t::NEIGHBORS && neighbors == nullptr) || nodeUsed == nullptr || (pendingCapacity > 0 && pending == nullptr))
+            {
+                g_deallocate_array<node_t>(m_allocator, nodes);
+                g_deallocate_array<neighbor_t>(m_allocator, neighbors);
+                g_deallocate_array<u32>(m_allocator, nodeUsed);
+                g_deallocate_array<pending_t>(m_allocator, pending);
+                return false;
+            }
+
+            u8 const* cursor = (u8 const*)buffer + sizeof(header);
+            nmem::memcpy(m_usedBins, cursor, sizeof(u8) * NUM_TOP_BINS);
+            cursor += sizeof(u8) * NUM_TOP_BINS;
+            nmem::memcpy(m_binIndices, cursor, sizeof(u32) * NUM_LEAF_BINS);
+            cursor += sizeof(u32) * NUM_LEAF_BINS;
+            nmem::memcpy(nodes, cursor, sizeof(node_t) * header.freeIndex);
+            cursor += sizeof(node_t) * header.freeIndex;
+            if (layout_t::NEIGHBORS)
+            {
+                nmem::memcpy(neighbors, cursor, sizeof(neighbor_t) * header.freeIndex);
+                cursor += sizeof(neighbor_t) * header.freeIndex;
+            }
+            nmem::memcpy(nodeUsed, cursor, sizeof(u32) * ((header.freeIndex + 31) >> 5));
+            cursor += sizeof(u32) * ((header.freeIndex + 31) >> 5);
+            if (header.pendingCount > 0)
+                nmem::memcpy(pending, cursor, sizeof(pending_t) * header.pendingCount);
+
+            g_deallocate_array<node_t>(m_allocator, m_nodes);
+            g_deallocate_array<neighbor_t>(m_allocator, m_neighbors);
+            g_deallocate_array<u32>(m_allocator, m_nodeUsed);
+            g_deallocate_array<pending_t>(m_allocator, m_pending);
+
+            m_nodes           = nodes;
+            m_neighbors       = neighbors;
+            m_nodeUsed        = nodeUsed;
+            m_maxAllocs       = maxAllocs;
+            m_freeOffset      = maxAllocs - 1;
+            m_freeStorage     = (T)header.freeStorage;
+            m_usedBinsTop     = (mask_t)header.usedBinsTop;
+            m_freeIndex       = header.freeIndex;
+            m_freeListHead    = header.freeListHead;
+            m_pending         = pending;
+            m_pendingCapacity = pendingCapacity;
+            m_pendingHead     = 0;
+            m_pendingCount    = header.pendingCount;
+
+            // The pending bits are not part of the blob, they follow from the queue
+            nmem::memset(m_nodeUsed + (maxAllocs >> 5), 0, sizeof(u32) * (maxAllocs >> 5));
+            for (u32 i = 0; i < m_pendingCount; i++)
+                setNodePending(m_pending[i].nodeIndex);
+            return true;
+        }
+
+        template <typename T, bool COMPACT> bool allocator_base_t<T, COMPACT>::reserveNodes(u32 count)
+        {
+            // Unused nodes at the end plus the first few of the free list
+            u32 available = m_maxAllocs - m_freeIndex;
+            u32 nodeIndex = m_freeListHead;
+            while (available < count && nodeIndex != node_t::NIL)
+            {
+                available++;
+                nodeIndex = binListNext(nodeIndex);
+            }
+            return available >= count || growNodes();
+        }
+
+        template <typename T, bool COMPACT> bool allocator_base_t<T, COMPACT>::growNodes()
+        {
+            // Geometric growth, node indices stay the same since the content is copied
+            if (m_maxAllocs >= m_limitAllocs)
+                return false;
+            const u32 maxAllocs = (m_maxAllocs > (m_limitAllocs >> 1)) ? m_limitAllocs : (m_maxAllocs << 1);
+
+            node_t*     nodes     = g_allocate_array<node_t>(m_allocator, maxAllocs);
+            neighbor_t* neighbors = layout_t::NEIGHBORS ? g_allocate_array<neighbor_t>(m_allocator, maxAllocs) : nullptr;
+            u32*        nodeUsed  = g_allocate_array<u32>(m_allocator, (maxAllocs >> 5) * 2);
+            if (nodes == nullptr || (layout_t::NEIGHBORS && neighbors == nullptr) || nodeUsed == nullptr)
+            {
+                g_deallocate_array<node_t>(m_allocator, nodes);
+                g_deallocate_array<neighbor_t>(m_allocator, neighbors);
+                g_deallocate_array<u32>(m_allocator, nodeUsed);
+                return false;
             }
+
+            nmem::memcpy(nodes, m_nodes, sizeof(node_t) * m_freeIndex);
+            nmem::memcpy(nodeUsed, m_nodeUsed, sizeof(u32) * (m_maxAllocs >> 5));
+            nmem::memcpy(nodeUsed + (maxAllocs >> 5), m_nodeUsed + (m_maxAllocs >> 5), sizeof(u32) * (m_maxAllocs >> 5));
+            if (layout_t::NEIGHBORS)
+                nmem::memcpy(neighbors, m_neighbors, sizeof(neighbor_t) * m_freeIndex);
+            g_deallocate_array<node_t>(m_allocator, m_nodes);
+            g_deallocate_array<neighbor_t>(m_allocator, m_neighbors);
+            g_deallocate_array<u32>(m_allocator, m_nodeUsed);
+
+            m_nodes      = nodes;
+            m_neighbors  = neighbors;
+            m_nodeUsed   = nodeUsed;
+            m_maxAllocs  = maxAllocs;
+            m_freeOffset = maxAllocs - 1;
+            return true;
         }
 
-        u32 allocator_t::insertNodeIntoBin(u32 size, u32 dataOffset)
+        template <typename T, bool COMPACT> u32 allocator_base_t<T, COMPACT>::insertNodeIntoBin(T size, T dataOffset)
         {
             // Round down to bin index to ensure that bin >= alloc
-            u32 binIndex = nfloat::U32ToF32RoundDown(size);
+            u32 binIndex = nfloat::ToBinRoundDown(size);
 
             u32 topBinIndex  = binIndex >> TOP_BINS_INDEX_SHIFT;
             u32 leafBinIndex = binIndex & LEAF_BINS_INDEX_MASK;
@@ -421,7 +940,7 @@ namespace ncore
             {
                 // Set bin mask bits
                 m_usedBins[topBinIndex] |= 1 << leafBinIndex;
-                m_usedBinsTop |= 1 << topBinIndex;
+                m_usedBinsTop |= (mask_t)1 << topBinIndex;
             }
 
             // Take a freelist node and insert on top of the bin linked list (next = old top)
@@ -430,11 +949,11 @@ namespace ncore
             if (m_freeListHead != node_t::NIL)
             {
                 nodeIndex      = m_freeListHead;
-                m_freeListHead = m_nodes[nodeIndex].binListNext;
+                m_freeListHead = binListNext(nodeIndex);
                 if (m_freeListHead != node_t::NIL)
-                    m_nodes[m_freeListHead].binListPrev = node_t::NIL;
+                    setBinListPrev(m_freeListHead, node_t::NIL);
             }
-            else if (m_freeIndex < m_maxAllocs)
+            else if (m_freeIndex < m_maxAllocs || growNodes())
             {
                 nodeIndex = m_freeIndex++;
             }
@@ -447,17 +966,16 @@ namespace ncore
 #ifdef DEBUG_VERBOSE
             printf("Getting node %u from freelist[%u]\n", nodeIndex, m_freeOffset + 1);
 #endif
-            m_nodes[nodeIndex].dataOffset  = dataOffset;
-            m_nodes[nodeIndex].dataSize    = size;
-            m_nodes[nodeIndex].binListNext = topNodeIndex;
-            m_nodes[nodeIndex].binListPrev = node_t::NIL;
+            layout_t::setFreeNode(m_nodes, nodeIndex, dataOffset, size);
+            setBinListNext(nodeIndex, topNodeIndex);
+            setBinListPrev(nodeIndex, node_t::NIL);
 
-            m_neighbors[nodeIndex].prev = node_t::NIL;
-            m_neighbors[nodeIndex].next = node_t::NIL;
+            neighborPrev(nodeIndex) = node_t::NIL;
+            neighborNext(nodeIndex) = node_t::NIL;
             setNodeUnused(nodeIndex);
 
             if (topNodeIndex != node_t::NIL)
-                m_nodes[topNodeIndex].binListPrev = nodeIndex;
+                setBinListPrev(topNodeIndex, nodeIndex);
             m_binIndices[binIndex] = nodeIndex;
 
             m_freeStorage += size;
@@ -468,29 +986,32 @@ namespace ncore
             return nodeIndex;
         }
 
-        void allocator_t::removeNodeFromBin(u32 nodeIndex)
+        template <typename T, bool COMPACT> void allocator_base_t<T, COMPACT>::removeNodeFromBin(u32 nodeIndex)
         {
-            node_t& node = m_nodes[nodeIndex];
+            // The neighbors of the node are still linked, its size is known before the bin links are reused
+            const T   dataSize = freeNodeSize(nodeIndex, freeNodeOffset(nodeIndex));
+            const u32 prev     = binListPrev(nodeIndex);
+            const u32 next     = binListNext(nodeIndex);
 
-            if (node.binListPrev != node_t::NIL)
+            if (prev != node_t::NIL)
             {
                 // Easy case: We have previous node. Just remove this node from the middle of the list.
-                m_nodes[node.binListPrev].binListNext = node.binListNext;
-                if (node.binListNext != node_t::NIL)
-                    m_nodes[node.binListNext].binListPrev = node.binListPrev;
+                setBinListNext(prev, next);
+                if (next != node_t::NIL)
+                    setBinListPrev(next, prev);
             }
             else
             {
                 // We are the first node in a bin. Find the bin.
                 // Round down to bin index to ensure that bin >= alloc
-                const u32 binIndex = nfloat::U32ToF32RoundDown(node.dataSize);
+                const u32 binIndex = nfloat::ToBinRoundDown(dataSize);
 
                 const u32 topBinIndex  = binIndex >> TOP_BINS_INDEX_SHIFT;
                 const u32 leafBinIndex = binIndex & LEAF_BINS_INDEX_MASK;
 
-                m_binIndices[binIndex] = node.binListNext;
-                if (node.binListNext != node_t::NIL)
-                    m_nodes[node.binListNext].binListPrev = node_t::NIL;
+                m_binIndices[binIndex] = next;
+                if (next != node_t::NIL)
+                    setBinListPrev(next, node_t::NIL);
 
                 // Bin empty?
                 if (m_binIndices[binIndex] == node_t::NIL)
@@ -502,7 +1023,7 @@ namespace ncore
                     if (m_usedBins[topBinIndex] == 0)
                     {
                         // Remove a top bin mask bit
-                        m_usedBinsTop &= ~(1 << topBinIndex);
+                        m_usedBinsTop &= ~((mask_t)1 << topBinIndex);
                     }
                 }
             }
@@ -511,38 +1032,30 @@ namespace ncore
 #ifdef DEBUG_VERBOSE
             printf("Putting node %u into freelist[%u] (removeNodeFromBin)\n", nodeIndex, m_freeOffset + 1);
 #endif
-            if (m_freeListHead == node_t::NIL)
-            {
-                node.binListPrev = node_t::NIL;
-                node.binListNext = node_t::NIL;
-                m_freeListHead   = nodeIndex;
-            }
-            else
-            {
-                node.binListPrev                    = node_t::NIL;
-                node.binListNext                    = m_freeListHead;
-                m_nodes[m_freeListHead].binListPrev = nodeIndex;
-                m_freeListHead                      = nodeIndex;
-            }
+            setBinListPrev(nodeIndex, node_t::NIL);
+            setBinListNext(nodeIndex, m_freeListHead);
+            if (m_freeListHead != node_t::NIL)
+                setBinListPrev(m_freeListHead, nodeIndex);
+            m_freeListHead = nodeIndex;
 
-            m_freeStorage -= node.dataSize;
+            m_freeStorage -= dataSize;
 #ifdef DEBUG_VERBOSE
-            printf("Free storage: %u (-%u) (removeNodeFromBin)\n", m_freeStorage, node.getDataSize());
+            printf("Free storage: %u (-%u) (removeNodeFromBin)\n", m_freeStorage, dataSize);
 #endif
         }
 
-        u32 allocator_t::allocationSize(allocation_t allocation) const
+        template <typename T, bool COMPACT> T allocator_base_t<T, COMPACT>::allocationSize(allocation_type allocation) const
         {
-            if (allocation.metadata == allocation_t::NO_SPACE || !m_nodes)
+            if (allocation.metadata == allocation_type::NO_NODE || !m_nodes)
                 return 0;
 
             return m_nodes[allocation.metadata].dataSize;
         }
 
-        storage_report_t allocator_t::storageReport() const
+        template <typename T, bool COMPACT> storage_report_base_t<T> allocator_base_t<T, COMPACT>::storageReport() const
         {
-            u32 largestFreeRegion = 0;
-            u32 freeStorage       = 0;
+            T largestFreeRegion = 0;
+            T freeStorage       = 0;
 
             // Out of allocations? -> Zero free space
             if (m_freeOffset > 0)
@@ -550,36 +1063,227 @@ namespace ncore
                 freeStorage = m_freeStorage;
                 if (m_usedBinsTop)
                 {
-                    u32 topBinIndex   = 31 - lzcnt_nonzero(m_usedBinsTop);
-                    u32 leafBinIndex  = 31 - lzcnt_nonzero(m_usedBins[topBinIndex]);
-                    largestFreeRegion = nfloat::F32ToU32((topBinIndex << TOP_BINS_INDEX_SHIFT) | leafBinIndex);
+                    u32 topBinIndex  = (sizeof(mask_t) * 8 - 1) - lzcnt_nonzero(m_usedBinsTop);
+                    u32 leafBinIndex = 31 - lzcnt_nonzero((u32)m_usedBins[topBinIndex]);
+                    nfloat::FromBin((topBinIndex << TOP_BINS_INDEX_SHIFT) | leafBinIndex, largestFreeRegion);
                     ASSERT(freeStorage >= largestFreeRegion);
                 }
             }
 
-            storage_report_t report;
+            storage_report_type report;
             report.totalFreeSpace    = freeStorage;
             report.largestFreeRegion = largestFreeRegion;
             return report;
         }
 
-        full_storage_report_t allocator_t::storageReportFull() const
+        template <typename T, bool COMPACT> full_storage_report_base_t<T> allocator_base_t<T, COMPACT>::storageReportFull() const
         {
-            full_storage_report_t report;
+            full_storage_report_type report;
             for (u32 i = 0; i < NUM_LEAF_BINS; i++)
             {
                 u32 count     = 0;
                 u32 nodeIndex = m_binIndices[i];
                 while (nodeIndex != node_t::NIL)
                 {
-                    nodeIndex = m_nodes[nodeIndex].binListNext;
+                    nodeIndex = binListNext(nodeIndex);
                     count++;
                 }
-                report.freeRegions[i].size  = nfloat::F32ToU32(i);
+                nfloat::FromBin(i, report.freeRegions[i].size);
                 report.freeRegions[i].count = count;
             }
             return report;
         }
+
+        template class allocator_base_t<u32, false>;
+        template class allocator_base_t<u64, false>;
+        template class allocator_base_t<u32, true>;
+        template class allocator_base_t<u64, true>;
+
+        // ------------------------------------------------------------------------------------------------
+        // Sharded allocator
+
+        // The lock and the base offset are on their own cache line, separate from the allocator
+        // state of this and the neighbouring shard.
+        struct sharded_allocator_t::shard_t
+        {
+            shard_t(alloc_t* allocator, u32 base, u32 size, u32 initialAllocs)
+                : m_lock(0), m_base(base), m_allocator(allocator, size, (u32)1 << SHARD_SHIFT, initialAllocs)
+            {
+            }
+
+            s32 volatile m_lock;
+            u32          m_base;
+            u8           m_pad0[64 - sizeof(s32) - sizeof(u32)];
+            allocator_t  m_allocator;
+            u8           m_pad1[64];
+
+            DCORE_CLASS_PLACEMENT_NEW_DELETE
+        };
+
+        // Shards grow their node arrays while holding only their own lock, the growth of all shards is
+        // serialized here so that the backing allocator is never entered by two threads at once.
+        struct sharded_allocator_t::locked_alloc_t : public alloc_t
+        {
+            locked_alloc_t(alloc_t* allocator) : m_allocator(allocator), m_lock(0) {}
+
+            alloc_t*     m_allocator;
+            s32 volatile m_lock;
+
+            DCORE_CLASS_PLACEMENT_NEW_DELETE
+
+        protected:
+            virtual void* v_allocate(u32 size, u32 alignment)
+            {
+                natomic::lock(&m_lock);
+                void* ptr = m_allocator->allocate(size, alignment);
+                natomic::unlock(&m_lock);
+                return ptr;
+            }
+
+            virtual void v_deallocate(void* ptr)
+            {
+                natomic::lock(&m_lock);
+                m_allocator->deallocate(ptr);
+                natomic::unlock(&m_lock);
+            }
+        };
+
+        sharded_allocator_t::sharded_allocator_t(alloc_t* allocator, u32 size, u32 numShards, u32 initialAllocs)
+            : m_allocator(allocator), m_shardAllocator(nullptr), m_size(size), m_initialAllocs(initialAllocs), m_numShards(numShards), m_shards(nullptr)
+        {
+            ASSERT(numShards > 0 && numShards <= MAX_SHARDS);
+            ASSERT(m_size < 0x80000000); // Size must be less than 2^31
+        }
+
+        sharded_allocator_t::~sharded_allocator_t() { teardown(); }
+
+        void sharded_allocator_t::setup()
+        {
+            // Every shard gets an equal part of the range and of the nodes, the last shard takes what
+            // remains of the range. Shards start at a multiple of SHARD_ALIGNMENT (when the range is
+            // large enough) so that an aligned offset within a shard is also aligned in the range.
+            // The nodes of a shard grow up to the number that fits in the metadata.
+            u32 shardSize = m_size / m_numShards;
+            if (shardSize >= SHARD_ALIGNMENT)
+                shardSize &= ~(SHARD_ALIGNMENT - 1);
+            const u32 shardInitialAllocs = m_initialAllocs / m_numShards;
+
+            m_shardAllocator = new (m_allocator->allocate(sizeof(locked_alloc_t))) locked_alloc_t(m_allocator);
+            m_shards         = (shard_t*)m_allocator->allocate(sizeof(shard_t) * m_numShards, 64);
+            for (u32 i = 0; i < m_numShards; i++)
+            {
+                const u32 base = i * shardSize;
+                const u32 size = (i == m_numShards - 1) ? (m_size - base) : shardSize;
+                shard_t*  shard = new (&m_shards[i]) shard_t(m_shardAllocator, base, size, shardInitialAllocs);
+                shard->m_allocator.setup();
+            }
+        }
+
+        void sharded_allocator_t::teardown()
+        {
+            if (m_shards == nullptr)
+                return;
+
+            for (u32 i = 0; i < m_numShards; i++)
+            {
+                m_shards[i].m_allocator.teardown();
+                m_shards[i].~shard_t();
+            }
+            m_allocator->deallocate(m_shards);
+            m_shards = nullptr;
+            m_shardAllocator->~locked_alloc_t();
+            m_allocator->deallocate(m_shardAllocator);
+            m_shardAllocator = nullptr;
+        }
+
+        void sharded_allocator_t::reset()
+        {
+            for (u32 i = 0; i < m_numShards; i++)
+                m_shards[i].m_allocator.reset();
+        }
+
+        u32 sharded_allocator_t::homeShard() const
+        {
+            // Fibonacci hash of the thread tag, distinct threads spread over the shards
+            const u64 tag = (u64)(uint_t)natomic::thread_tag();
+            return (u32)(((tag >> 4) * 0x9E3779B97F4A7C15ull) >> 40) % m_numShards;
+        }
+
+        allocation_t sharded_allocator_t::allocate(u32 size, u32 alignment)
+        {
+            // Home shard first, then the others in order
+            const u32 home = homeShard();
+            for (u32 n = 0; n < m_numShards; n++)
+            {
+                const u32 i     = (home + n) < m_numShards ? (home + n) : (home + n - m_numShards);
+                shard_t&  shard = m_shards[i];
+
+                natomic::lock(&shard.m_lock);
+                ASSERT((shard.m_base & (alignment - 1)) == 0); // Shards are aligned to SHARD_ALIGNMENT
+                allocation_t a = shard.m_allocator.allocate(size, alignment);
+                natomic::unlock(&shard.m_lock);
+
+                if (a.offset != allocation_t::NO_SPACE)
+                {
+                    a.offset += shard.m_base;
+                    a.metadata |= i << SHARD_SHIFT;
+                    return a;
+                }
+            }
+
+            allocation_t a;
+            a.offset   = allocation_t::NO_SPACE;
+            a.metadata = allocation_t::NO_NODE;
+            return a;
+        }
+
+        void sharded_allocator_t::free(allocation_t allocation)
+        {
+            ASSERT(allocation.metadata != allocation_t::NO_NODE);
+            const u32 i = allocation.metadata >> SHARD_SHIFT;
+            ASSERT(i < m_numShards);
+
+            shard_t& shard = m_shards[i];
+            allocation.metadata &= ((u32)1 << SHARD_SHIFT) - 1;
+            allocation.offset -= shard.m_base;
+
+            natomic::lock(&shard.m_lock);
+            shard.m_allocator.free(allocation);
+            natomic::unlock(&shard.m_lock);
+        }
+
+        u32 sharded_allocator_t::allocationSize(allocation_t allocation) const
+        {
+            if (allocation.metadata == allocation_t::NO_NODE || m_shards == nullptr)
+                return 0;
+
+            shard_t& shard = m_shards[allocation.metadata >> SHARD_SHIFT];
+            allocation.metadata &= ((u32)1 << SHARD_SHIFT) - 1;
+
+            natomic::lock(&shard.m_lock);
+            const u32 size = shard.m_allocator.allocationSize(allocation);
+            natomic::unlock(&shard.m_lock);
+            return size;
+        }
+
+        storage_report_t sharded_allocator_t::storageReport() const
+        {
+            storage_report_t report;
+            report.totalFreeSpace    = 0;
+            report.largestFreeRegion = 0;
+            for (u32 i = 0; i < m_numShards; i++)
+            {
+                shard_t& shard = m_shards[i];
+                natomic::lock(&shard.m_lock);
+                const storage_report_t r = shard.m_allocator.storageReport();
+                natomic::unlock(&shard.m_lock);
+
+                report.totalFreeSpace += r.totalFreeSpace;
+                if (r.largestFreeRegion > report.largestFreeRegion)
+                    report.largestFreeRegion = r.largestFreeRegion;
+            }
+            return report;
+        }
     } // namespace noffset
 
 } // namespace ncore
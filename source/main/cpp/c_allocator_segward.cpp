@@ -4,6 +4,7 @@
 #include "ccore/c_arena.h"
 
 #include "callocator/c_allocator_segward.h"
+#include "c_allocator_vmem.h"
 
 namespace ncore
 {
@@ -17,12 +18,16 @@ namespace ncore
             u16      m_segment;              // current segment index being allocated from
             u16      m_segment_count;        // total number of segments
             u16      m_segment_size_shift;   // size (1 << m_segment_size_shift) of each segment (power of two)
+            int_t    m_base_offset;          // offset of the first segment from the base of the arena
         };
 
-        allocator_t* create(int_t segment_size, int_t total_size)
+        allocator_t* create(int_t segment_size, int_t total_size, bool huge_pages)
         {
-            // power-of-2 upper bound of segment size
+            // power-of-2 upper bound of segment size, segments are committed as a whole so with huge
+            // pages a segment is at least one huge page
             segment_size = math::ceilpo2(segment_size);
+            if (huge_pages && segment_size < nvmem::HUGE_PAGE_SIZE)
+                segment_size = nvmem::HUGE_PAGE_SIZE;
             if (segment_size < 4096 || segment_size > (1 << 30))
                 return nullptr;
 
@@ -34,7 +39,8 @@ namespace ncore
             if (max_segments < min_segments || max_segments >= 32768)
                 return nullptr;
 
-            arena_t* arena = narena::new_arena(total_size + (int_t)(4 * cKB), (int_t)(4 * cKB) + (min_segments * segment_size));
+            const int_t reserved = total_size + (int_t)(4 * cKB) + (huge_pages ? (int_t)nvmem::HUGE_PAGE_SIZE : 0);
+            arena_t*    arena    = narena::new_arena(reserved, (int_t)(4 * cKB) + (min_segments * segment_size));
 
             allocator_t* allocator          = g_allocate_and_clear<allocator_t>(arena);
             allocator->m_arena              = arena;
@@ -42,15 +48,24 @@ namespace ncore
             allocator->m_segment_count      = max_segments;
             allocator->m_segment_size_shift = (s8)math::ilog2(segment_size);
 
-            // make sure the arena allocations start at 4 KB boundary
-            narena::alloc(arena, (int_t)(4 * cKB) - (int_t)((const byte*)narena::current_address(arena) - (const byte*)narena::base(arena)));
+            // make sure the arena allocations start at 4 KB boundary, or at a 2 MB boundary with huge pages
+            if (huge_pages)
+            {
+                nvmem::arena_align_huge(arena, reserved);
+                allocator->m_base_offset = (int_t)((const byte*)narena::current_address(arena) - (const byte*)narena::base(arena));
+            }
+            else
+            {
+                narena::alloc(arena, (int_t)(4 * cKB) - (int_t)((const byte*)narena::current_address(arena) - (const byte*)narena::base(arena)));
+                allocator->m_base_offset = (int_t)1 << arena->m_page_size_shift;
+            }
 
             // start with first segment, and mark first segment as active
             allocator->m_segment              = 0;
             allocator->m_segment_alloc_cursor = 0;
 
             // commit first segment
-            const int_t committed_size_in_bytes = (1 << allocator->m_segment_size_shift) + ((int_t)1 << allocator->m_arena->m_page_size_shift);
+            const int_t committed_size_in_bytes = (1 << allocator->m_segment_size_shift) + allocator->m_base_offset;
             DVERIFY(narena::commit(allocator->m_arena, committed_size_in_bytes), true);
 
             for (i16 i = 0; i < min_segments; i++)
@@ -89,7 +104,7 @@ namespace ncore
                 a->m_segment_counters[a->m_segment] += 1;
 
                 // return the absolute address: base + segment_offset + aligned
-                return (u8*)narena::base(a->m_arena) + ((int_t)1 << a->m_arena->m_page_size_shift) + aligned;
+                return (u8*)narena::base(a->m_arena) + a->m_base_offset + aligned;
             }
 
             // segment cannot satisfy request, search for a new segment and make that the active one
@@ -103,7 +118,7 @@ namespace ncore
 
                 if (count < 0)
                 { // Extend the committed region to include this segment
-                    const int_t committed_size_in_bytes = ((i + 1) << a->m_segment_size_shift) + ((int_t)1 << a->m_arena->m_page_size_shift);
+                    const int_t committed_size_in_bytes = ((i + 1) << a->m_segment_size_shift) + a->m_base_offset;
                     DVERIFY(narena::commit(a->m_arena, committed_size_in_bytes), true);
                 }
 
@@ -120,7 +135,7 @@ namespace ncore
                 a->m_segment_counters[a->m_segment] = 1;
 
                 // return the absolute address: base + aligned cursor
-                return (u8*)narena::base(a->m_arena) + ((int_t)1 << a->m_arena->m_page_size_shift) + aligned;
+                return (u8*)narena::base(a->m_arena) + a->m_base_offset + aligned;
             }
 
             // No new segment found, out of memory
@@ -133,10 +148,10 @@ namespace ncore
             ASSERT(a != nullptr && ptr != nullptr);
 
             // Check if pointer is outside of the arena
-            ASSERT(((const u8*)ptr >= ((const u8*)narena::base(a->m_arena) + ((int_t)1 << a->m_arena->m_page_size_shift))) && narena::within_committed(a->m_arena, ptr));
+            ASSERT(((const u8*)ptr >= ((const u8*)narena::base(a->m_arena) + a->m_base_offset)) && narena::within_committed(a->m_arena, ptr));
 
             // Which segment is this coming from and is it valid?
-            const u32 segment = (u32)(((const u8*)ptr - ((const u8*)narena::base(a->m_arena) + ((int_t)1 << a->m_arena->m_page_size_shift))) >> a->m_segment_size_shift);
+            const u32 segment = (u32)(((const u8*)ptr - ((const u8*)narena::base(a->m_arena) + a->m_base_offset)) >> a->m_segment_size_shift);
             ASSERT(segment < a->m_segment_count); // invalid segment index
 
             // Decrement the segment counter
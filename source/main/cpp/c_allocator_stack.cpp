@@ -6,6 +6,7 @@
 #include "cbase/c_context.h"
 
 #include "callocator/c_allocator_stack.h"
+#include "c_allocator_vmem.h"
 
 namespace ncore
 {
@@ -20,7 +21,7 @@ namespace ncore
     public:
         DCORE_CLASS_PLACEMENT_NEW_DELETE
 
-        stack_allocator_t(arena_t* arena);
+        stack_allocator_t(arena_t* arena, bool huge_pages);
         virtual ~stack_allocator_t() {}
 
         void reset();
@@ -28,6 +29,7 @@ namespace ncore
         arena_t* m_arena;
         void*    m_save_address;
         int_t    m_allocation_count;
+        bool     m_huge_pages;
 
     protected:
         virtual void* v_allocate(u32 size, u32 alignment) final;
@@ -38,7 +40,7 @@ namespace ncore
         friend class stack_alloc_scope_t;
     };
 
-    stack_allocator_t::stack_allocator_t(arena_t* arena) : m_arena(arena), m_allocation_count(0) {}
+    stack_allocator_t::stack_allocator_t(arena_t* arena, bool huge_pages) : m_arena(arena), m_allocation_count(0), m_huge_pages(huge_pages) {}
 
     void stack_allocator_t::reset()
     {
@@ -49,6 +51,8 @@ namespace ncore
     void* stack_allocator_t::v_allocate(u32 size, u32 alignment)
     {
         m_allocation_count++;
+        if (m_huge_pages)
+            return nvmem::arena_alloc_huge(m_arena, size, alignment);
         return narena::alloc(m_arena, size, alignment);
     }
 
@@ -76,12 +80,17 @@ namespace ncore
         narena::restore_address(m_arena, point);
     }
 
-    stack_alloc_t* g_create_stack_allocator(int_t initial_size, int_t reserved_size)
+    stack_alloc_t* g_create_stack_allocator(int_t initial_size, int_t reserved_size, bool huge_pages)
     {
+        if (huge_pages)
+            reserved_size = nvmem::huge_page_align(reserved_size) + nvmem::HUGE_PAGE_SIZE; // room to align the memory
+
         arena_t*           arena     = narena::new_arena(reserved_size, initial_size);
         void*              mem       = narena::alloc(arena, sizeof(stack_allocator_t));
-        stack_allocator_t* allocator = new (mem) stack_allocator_t(arena);
-        allocator->m_save_address    = narena::current_address(arena);
+        stack_allocator_t* allocator = new (mem) stack_allocator_t(arena, huge_pages);
+        if (huge_pages)
+            nvmem::arena_align_huge(arena, reserved_size);
+        allocator->m_save_address = narena::current_address(arena);
         return allocator;
     }
 
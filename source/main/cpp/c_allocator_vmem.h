@@ -0,0 +1,92 @@
+#ifndef __C_ALLOCATOR_VMEM_H__
+#define __C_ALLOCATOR_VMEM_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "ccore/c_arena.h"
+
+#if defined(CC_PLATFORM_WINDOWS)
+#    ifndef WIN32_LEAN_AND_MEAN
+#        define WIN32_LEAN_AND_MEAN
+#    endif
+#    include <windows.h>
+#else
+#    include <sys/mman.h>
+#endif
+
+// Internal, minimal set of virtual memory operations on memory that is reserved and
+// committed through an arena. Not part of the public interface.
+namespace ncore
+{
+    namespace nvmem
+    {
+        // Give the physical pages of a committed range back to the OS while keeping the range
+        // accessible, the pages are backed again on first touch and their content is lost.
+        inline bool purge(void* addr, int_t size)
+        {
+#if defined(CC_PLATFORM_WINDOWS)
+            return ::VirtualAlloc(addr, (SIZE_T)size, MEM_RESET, PAGE_READWRITE) != nullptr;
+#elif defined(CC_PLATFORM_MAC) && defined(MADV_FREE)
+            return ::madvise(addr, (size_t)size, MADV_FREE) == 0;
+#else
+            return ::madvise(addr, (size_t)size, MADV_DONTNEED) == 0;
+#endif
+        }
+
+        // Huge pages, on Linux a range can be backed by transparent huge pages (2 MB) which cuts the
+        // number of TLB misses on large working sets. Only the 2 MB aligned parts of a range can use
+        // them, so the allocators align their memory to 2 MB and commit in 2 MB units. Windows large
+        // pages need a privilege and a dedicated reservation, there (and on Mac) this is a no-op.
+        enum EHugePage
+        {
+            HUGE_PAGE_SHIFT = 21,
+            HUGE_PAGE_SIZE  = 1 << HUGE_PAGE_SHIFT,
+        };
+
+        inline int_t huge_page_align(int_t size) { return (size + (HUGE_PAGE_SIZE - 1)) & ~((int_t)HUGE_PAGE_SIZE - 1); }
+
+        inline void advise_huge_pages(void* addr, int_t size)
+        {
+#if defined(MADV_HUGEPAGE)
+            // madvise wants a page aligned address
+            const uint_t begin = ((uint_t)addr + 4095) & ~(uint_t)4095;
+            const uint_t end   = (uint_t)addr + (uint_t)size;
+            if (end > begin)
+                ::madvise((void*)begin, (size_t)(end - begin), MADV_HUGEPAGE);
+#else
+            (void)addr;
+            (void)size;
+#endif
+        }
+
+        // Move the current address of an arena to the next 2 MB boundary and advise the rest of the
+        // reservation (the arena was created with 'reserved' bytes) to use huge pages.
+        inline void* arena_align_huge(arena_t* arena, int_t reserved)
+        {
+            const int_t offset   = (int_t)((byte*)narena::current_address(arena) - (byte*)narena::base(arena));
+            const int_t misalign = (int_t)((uint_t)narena::base(arena) & (HUGE_PAGE_SIZE - 1));
+            const int_t pad      = huge_page_align(misalign + offset) - (misalign + offset);
+            if (pad > 0)
+                narena::alloc(arena, pad, 1);
+            void* aligned = narena::current_address(arena);
+            advise_huge_pages(aligned, reserved - offset - pad);
+            return aligned;
+        }
+
+        // Allocate from an arena, committing in 2 MB units whenever the committed range is exceeded.
+        // When the last unit does not fit in the reservation narena::alloc commits what it needs.
+        inline void* arena_alloc_huge(arena_t* arena, int_t size, u32 alignment)
+        {
+            const uint_t current = (uint_t)narena::current_address(arena);
+            const uint_t end     = ((current + (alignment - 1)) & ~(uint_t)(alignment - 1)) + (uint_t)size;
+            if (size > 0 && !narena::within_committed(arena, (void*)(end - 1)))
+                narena::commit(arena, huge_page_align((int_t)(end - (uint_t)narena::base(arena))));
+            return narena::alloc(arena, size, alignment);
+        }
+
+    } // namespace nvmem
+} // namespace ncore
+
+#endif // __C_ALLOCATOR_VMEM_H__
@@ -42,7 +42,9 @@ namespace ncore
             s32 m_ended;
         };
 
-        void setup(s32 max_active_frames, int_t average_frame_size, int_t max_reserved_size);
+        // With 'huge_pages' the memory of each lane is 2 MB aligned, committed in 2 MB units and advised
+        // to use transparent huge pages (Linux), which reduces TLB misses on large frames.
+        void setup(s32 max_active_frames, int_t average_frame_size, int_t max_reserved_size, bool huge_pages = false);
         void reset();
 
         DCORE_CLASS_PLACEMENT_NEW_DELETE
@@ -55,6 +57,8 @@ namespace ncore
         frame_t* m_frames[2];         // N frames per lane
         void*    m_save_addresses[2]; // Arena save addresses for each lane
         arena_t* m_arena[2];          // Virtual memory arenas
+        int_t    m_reserved;          // Reserved size of each arena
+        bool     m_huge_pages;        // Memory is committed in huge page units
 
     private:
         virtual void* v_allocate(u32 size, u32 alignment) final;
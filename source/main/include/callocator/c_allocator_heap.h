@@ -5,38 +5,247 @@
 #    pragma once
 #endif
 
+#include "ccore/c_allocator.h"
+
+// The heap is configured with defines (TLSF_COMPACT_HEADER, HEAP_CATEGORIES) that change its types,
+// the configuration is part of the symbol names so that code compiled with other defines than the
+// heap fails to link instead of silently using a different heap_t.
+#if defined(HEAP_CATEGORIES)
+#    define HEAP_VARIANT nheap_categories
+#elif defined(TLSF_COMPACT_HEADER)
+#    define HEAP_VARIANT nheap_compact_header
+#else
+#    define HEAP_VARIANT nheap_default
+#endif
+
 namespace ncore
 {
-    struct heap_t;
-
-    namespace nheap
+    inline namespace HEAP_VARIANT
     {
-        typedef void* (*resize_fn)(heap_t* h, int_t new_size);
-        struct context_t;
-    } // namespace nheap
+        struct heap_t;
 
-    struct heap_t
-    {
-        nheap::context_t* m_context;
-        nheap::resize_fn  m_resize_fn;
-        arena_t*          m_arena;
-        void*             m_save_point;
-    };
-
-    heap_t* g_heap_create(int_t initial_size, int_t reserved_size);
-    void*   g_heap_alloc(heap_t* allocator, u32 size);
-    void*   g_heap_alloc_fill(heap_t* allocator, u32 size, u32 fill);
-    void    g_heap_dealloc(heap_t* allocator, void* ptr);
-    void    g_heap_release(heap_t* allocator);
-
-    // Some C++ style helper functions
-    template <typename T> inline T*   g_allocate(heap_t* heap) { return (T*)g_heap_alloc(heap, sizeof(T)); }
-    template <typename T> inline void g_deallocate(heap_t* heap, T* ptr) { g_heap_dealloc(heap, (void*)ptr); }
-    template <typename T> inline T*   g_allocate_and_clear(heap_t* heap) { return (T*)g_heap_alloc_fill(heap, sizeof(T), 0); }
-    template <typename T> inline T*   g_allocate_array(heap_t* heap, u32 maxsize) { return (T*)g_heap_alloc(heap, maxsize * sizeof(T)); }
-    template <typename T> inline T*   g_allocate_array_and_clear(heap_t* heap, u32 maxsize) { return (T*)g_heap_alloc_fill(heap, maxsize * sizeof(T), 0); }
-    template <typename T> inline T*   g_allocate_array_and_fill(heap_t* heap, u32 maxsize, u32 fill) { return (T*)g_heap_alloc_fill(heap, maxsize * sizeof(T), fill); }
+        namespace nheap
+        {
+            typedef void* (*resize_fn)(heap_t* h, int_t new_size);
+            struct context_t;
+            struct slabs_t;
+            struct pool_t;
+            struct huges_t;
+            struct checkpoint_t;
+            struct handles_t;
+        } // namespace nheap
+
+        // Live allocations of one category, see g_heap_categories
+        struct heap_category_t
+        {
+            int_t m_bytes; // usable size of the live allocations
+            int_t m_count; // number of live allocations
+        };
+
+        enum EHeapCategory
+        {
+            HEAP_CATEGORY_NONE  = 0, // allocations that are not tagged
+            HEAP_CATEGORY_COUNT = 256,
+        };
+
+        // A snapshot of the free memory of a heap, see g_heap_report
+        struct heap_report_t
+        {
+            enum
+            {
+                FL_BINS = 32, // first level bins, not all of them are used by every configuration
+                SL_BINS = 16, // second level bins
+            };
+
+            int_t m_free_bytes;             // total size of the free blocks
+            int_t m_largest_free;           // size of the largest free block
+            int_t m_slab_free_bytes;        // free objects in partially used slabs
+            int_t m_committed;              // committed memory of the main region, the pools and the huge allocations
+            int_t m_reserved;               // reserved address space of the same
+            u32   m_free_blocks;            // number of free blocks
+            u32   m_bins[FL_BINS][SL_BINS]; // number of free blocks per (fl, sl) bin
+        };
+
+        struct heap_t
+        {
+            nheap::context_t*    m_context;
+            nheap::slabs_t*      m_slabs;           // slabs for small size-classes (<= 128 bytes)
+            nheap::pool_t*       m_pools;           // additional regions, see g_heap_add_pool
+            nheap::huges_t*      m_huge;            // allocations that have their own arena, see g_heap_set_huge_threshold
+            nheap::checkpoint_t* m_checkpoint;      // see g_heap_checkpoint
+            nheap::handles_t*    m_handles;         // relocatable allocations, see g_heap_handle_alloc
+            int_t                m_purge_threshold; // purge when this many bytes were freed since the last purge, 0 = never
+            int_t                m_purge_dirty;     // bytes freed since the last purge
+            nheap::resize_fn     m_resize_fn;
+            arena_t*             m_arena;
+            void*                m_save_point;
+            s32 volatile         m_lock;            // guards m_context when the heap is shared through thread caches
+            void*                m_owner;           // tag of the thread that owns the heap
+            void* volatile       m_remote_free;     // blocks released by other threads, drained by the owner
+            u32                  m_fit_scan;        // best-fit, free blocks that are compared per search, 0 = good-fit
+#ifdef HEAP_CATEGORIES
+            heap_category_t*     m_categories;      // HEAP_CATEGORY_COUNT entries
+#endif
+        };
+
+        // With 'huge_pages' the heap region is 2 MB aligned, committed in 2 MB units and advised to use
+        // transparent huge pages (Linux), which reduces TLB misses on large heaps.
+        heap_t* g_heap_create(int_t initial_size, int_t reserved_size, bool huge_pages = false);
+        void*   g_heap_alloc(heap_t* allocator, u32 size);
+        void*   g_heap_alloc_fill(heap_t* allocator, u32 size, u32 fill);
+        void*   g_heap_alloc_aligned(heap_t* allocator, u32 size, u32 align); // align must be a power of two
+        void*   g_heap_alloc_aligned_fill(heap_t* allocator, u32 size, u32 align, u32 fill);
+        void    g_heap_dealloc(heap_t* allocator, void* ptr);
+        void    g_heap_release(heap_t* allocator);
+
+        // The number of bytes that can be used from an allocation, which can be more than what was
+        // requested (rounding to a size-class or block size), containers can grow into this slack.
+        // g_heap_dealloc_sized takes the size that was requested (or any size up to the usable size),
+        // it uses the size to skip looking up where the allocation came from, in debug builds the
+        // size is verified against the allocation.
+        u32  g_heap_usable_size(heap_t* allocator, void* ptr);
+        void g_heap_dealloc_sized(heap_t* allocator, void* ptr, u32 size);
+
+        // Categories, compile with HEAP_CATEGORIES to be able to tag an allocation with a category id
+        // that tells which subsystem owns it. The heap keeps the live bytes and the number of live
+        // allocations per category, g_heap_categories copies them out at any time. The id is kept in
+        // spare bits of the block header (64-bit, not with compact headers), in a byte per object of
+        // a slab and in the entry of a huge allocation. Untagged allocations count as HEAP_CATEGORY_NONE,
+        // allocations made through a thread cache are not accounted. Without HEAP_CATEGORIES the
+        // tagged functions forward to the untagged ones and g_heap_categories returns 0.
+#ifdef HEAP_CATEGORIES
+        void* g_heap_alloc(heap_t* allocator, u32 size, u8 category);
+        void* g_heap_alloc_aligned(heap_t* allocator, u32 size, u32 align, u8 category);
+        u32   g_heap_categories(heap_t* allocator, heap_category_t* stats, u32 count); // returns the number of entries written
+#else
+        inline void* g_heap_alloc(heap_t* allocator, u32 size, u8) { return g_heap_alloc(allocator, size); }
+        inline void* g_heap_alloc_aligned(heap_t* allocator, u32 size, u32 align, u8) { return g_heap_alloc_aligned(allocator, size, align); }
+        inline u32   g_heap_categories(heap_t*, heap_category_t*, u32) { return 0; }
+#endif
+
+        // Report, the free memory of the heap per (fl, sl) bin together with the total, the largest
+        // free block and the committed vs. reserved memory. It is computed from the bitmaps and the
+        // free lists, the cost depends on the number of free blocks and not on the size of the heap.
+        // While a checkpoint is active the memory from before the checkpoint is not reported as free.
+        void g_heap_report(heap_t* allocator, heap_report_t* report);
+
+        // Fit policy, by default (good-fit) a block is taken from the head of the first non-empty bin
+        // that only holds blocks that are large enough, this is O(1) but can pick a block that is up to
+        // 1/16 larger than needed. With best-fit the bin that the size itself maps to is searched first
+        // and otherwise the smallest block in the good-fit bin is taken, comparing at most 'max_scan'
+        // free blocks per bin. This trades latency for footprint, on the mixed-size trace of the
+        // benchmark a scan of 4 to 64 blocks cost 6% to 22% more time per operation for a peak
+        // footprint that was about 2% lower.
+        void g_heap_set_best_fit(heap_t* allocator, u32 max_scan); // 0 = good-fit
+
+        // Handles, a relocatable allocation is referenced through a handle that resolves to its current
+        // address, the compactor may move it. g_heap_compact slides relocatable allocations towards the
+        // start of their region into the free block in front of them, so free memory collects at the
+        // tail where it is given back to the arena. It works incrementally, a call moves about 'budget'
+        // bytes (every visited handle costs a little, so a call is bounded even when nothing moves) and
+        // continues where the previous call stopped. It returns true when a full pass over the handles
+        // found nothing to move. Other allocations are never moved, free memory in front of them stays.
+        // An address returned by g_heap_handle_get is valid until the next call to g_heap_compact.
+        // Compaction is skipped while a checkpoint is active.
+        typedef u32 heap_handle_t; // 0 = null
+
+        heap_handle_t g_heap_handle_alloc(heap_t* allocator, u32 size);
+        void          g_heap_handle_free(heap_t* allocator, heap_handle_t handle);
+        void*         g_heap_handle_get(heap_t* allocator, heap_handle_t handle);
+        bool          g_heap_compact(heap_t* allocator, int_t budget);
+
+        // Huge allocations, sizes at or above the threshold (default 4 MB) are not taken from the heap
+        // but each get their own virtual memory arena that is released on deallocation. Such an
+        // allocation is page aligned and cannot grow in place.
+        void g_heap_set_huge_threshold(heap_t* allocator, int_t bytes); // 0 disables
+
+        // Checkpoint, take a snapshot of the heap and later roll back to it, which discards every
+        // allocation made after the checkpoint at the cost of restoring the TLSF context. While a
+        // checkpoint is active, allocations come from fresh memory at the tail of the heap, memory
+        // that was allocated before the checkpoint can still be used and freed, but those frees are
+        // only done at the rollback. One checkpoint can be active at a time, it is not supported on
+        // a heap that is shared through thread caches.
+        void g_heap_checkpoint(heap_t* allocator);
+        void g_heap_rollback(heap_t* allocator);
+
+        // Purge, the pages spanned by free blocks stay committed, a purge gives the physical pages
+        // of those blocks back to the OS (they are backed again when the memory is used). This can
+        // be done explicitly or by setting a threshold, when that many bytes have been freed since
+        // the last purge, g_heap_dealloc runs a purge. Free blocks that were purged before and have not
+        // been freed, merged or split since are skipped. Returns the number of bytes purged.
+        int_t g_heap_purge(heap_t* allocator);
+        void  g_heap_set_purge_threshold(heap_t* allocator, int_t bytes); // 0 disables
+
+        // Pools, a heap can manage additional non-contiguous regions next to its own arena. When the
+        // arena reaches its reserved size the heap creates pools on its own and releases them again
+        // when they become completely free, so a heap does not need a large up-front reservation.
+        // Memory can also be handed to the heap by the caller, such a pool stays in the heap until
+        // it is removed, which only succeeds when none of its memory is in use.
+        bool g_heap_add_pool(heap_t* allocator, void* mem, int_t size);
+        bool g_heap_remove_pool(heap_t* allocator, void* mem);
+
+        // Resize an allocation, growing and shrinking happen in place whenever possible.
+        // g_heap_realloc moves the data to a new block when the allocation cannot grow in place,
+        // g_heap_try_expand only grows in place and returns false otherwise (ptr stays valid),
+        // g_heap_shrink returns the tail of the block beyond new_size to the heap.
+        void* g_heap_realloc(heap_t* allocator, void* ptr, u32 size);
+        bool  g_heap_try_expand(heap_t* allocator, void* ptr, u32 new_size);
+        void  g_heap_shrink(heap_t* allocator, void* ptr, u32 new_size);
+
+        // A heap is owned by the thread that created it, only the owner may allocate from it.
+        // Any thread may deallocate, a block released by another thread is pushed on a lock-free
+        // list and merged back into the heap by the owner on its next allocation.
+        void g_heap_set_owner(heap_t* allocator); // make the calling thread the owner
+
+        // Thread cache
+        // An optional per-thread front-end for a heap that is shared between threads. Small sizes
+        // (<= 256 bytes) are served from per size-class free lists owned by the calling thread, the
+        // shared TLSF context is only touched (under the heap lock) to refill or flush a size-class
+        // in batches. Larger sizes go straight to the shared context, also under the heap lock.
+        // Create one cache per thread, on a heap that is shared this way the owner thread should not
+        // call g_heap_alloc/g_heap_dealloc since those do not take the heap lock.
+        struct heap_tcache_t;
+
+        heap_tcache_t* g_heap_tcache_create(heap_t* heap);
+        void*          g_heap_tcache_alloc(heap_tcache_t* cache, u32 size);
+        void           g_heap_tcache_dealloc(heap_tcache_t* cache, void* ptr);
+        void           g_heap_tcache_flush(heap_tcache_t* cache); // return all cached blocks to the heap
+        void           g_heap_tcache_destroy(heap_tcache_t* cache);
+
+        // An alloc_t on top of a heap, so that anything that takes an alloc_t (cs_alloc_t, nocs, noffset,
+        // nsegment, ...) can keep its bookkeeping in a heap instead of on the system allocator.
+        // The alignment that is asked for is honoured.
+        class heap_alloc_t : public alloc_t
+        {
+        public:
+            inline heap_alloc_t(heap_t* heap) : m_heap(heap) {}
+
+            DCORE_CLASS_PLACEMENT_NEW_DELETE
+
+            heap_t* m_heap;
+
+        protected:
+            virtual void* v_allocate(u32 size, u32 alignment) final;
+            virtual void  v_deallocate(void* ptr) final;
+        };
+
+        // Create a heap together with an alloc_t for it, the alloc_t lives in the heap itself
+        alloc_t* g_create_heap(int_t initial_size, int_t reserved_size, bool huge_pages = false);
+        void     g_release_heap(alloc_t* allocator);
+
+        // Some C++ style helper functions, these honour the alignment of T
+        template <typename T> inline T*   g_allocate(heap_t* heap) { return (T*)g_heap_alloc_aligned(heap, sizeof(T), alignof(T)); }
+        template <typename T> inline void g_deallocate(heap_t* heap, T* ptr) { g_heap_dealloc(heap, (void*)ptr); }
+        template <typename T> inline T*   g_allocate_and_clear(heap_t* heap) { return (T*)g_heap_alloc_aligned_fill(heap, sizeof(T), alignof(T), 0); }
+        template <typename T> inline T*   g_allocate_array(heap_t* heap, u32 maxsize) { return (T*)g_heap_alloc_aligned(heap, maxsize * sizeof(T), alignof(T)); }
+        template <typename T> inline T*   g_allocate_array_and_clear(heap_t* heap, u32 maxsize) { return (T*)g_heap_alloc_aligned_fill(heap, maxsize * sizeof(T), alignof(T), 0); }
+        template <typename T> inline T*   g_allocate_array_and_fill(heap_t* heap, u32 maxsize, u32 fill) { return (T*)g_heap_alloc_aligned_fill(heap, maxsize * sizeof(T), alignof(T), fill); }
 
+        // Array helpers with an explicit alignment, e.g. 32/64 bytes for SIMD or 4 KB for I/O buffers
+        template <typename T> inline T* g_allocate_array(heap_t* heap, u32 maxsize, u32 align) { return (T*)g_heap_alloc_aligned(heap, maxsize * sizeof(T), align); }
+        template <typename T> inline T* g_allocate_array_and_clear(heap_t* heap, u32 maxsize, u32 align) { return (T*)g_heap_alloc_aligned_fill(heap, maxsize * sizeof(T), align, 0); }
+        template <typename T> inline T* g_allocate_array_and_fill(heap_t* heap, u32 maxsize, u32 align, u32 fill) { return (T*)g_heap_alloc_aligned_fill(heap, maxsize * sizeof(T), align, fill); }
+    } // namespace HEAP_VARIANT
 }; // namespace ncore
 
 #endif /// __C_HEAP_ALLOCATOR_H__
@@ -19,87 +19,299 @@ namespace ncore
         static constexpr u32 LEAF_BINS_INDEX_MASK = 0x7;
         static constexpr u32 NUM_LEAF_BINS        = NUM_TOP_BINS * BINS_PER_LEAF;
 
-        struct allocation_t
+        // The offset and size type, u32 for ranges below 2 GB and u64 for ranges up to 2^63 bytes.
+        // The 64-bit variant has twice the number of top bins, the bin structure is otherwise the same.
+        template <typename T> struct offset_traits_t;
+        template <> struct offset_traits_t<u32>
         {
-            static constexpr u32 NO_SPACE = 0xffffffff;
+            typedef u32          mask_t;
+            static constexpr u32 NUM_TOP_BINS  = 32;
+            static constexpr u32 NUM_LEAF_BINS = NUM_TOP_BINS * BINS_PER_LEAF;
+            static constexpr u32 MAX_SIZE      = 0x80000000;
+        };
+        template <> struct offset_traits_t<u64>
+        {
+            typedef u64          mask_t;
+            static constexpr u32 NUM_TOP_BINS  = 64;
+            static constexpr u32 NUM_LEAF_BINS = NUM_TOP_BINS * BINS_PER_LEAF;
+            static constexpr u64 MAX_SIZE      = 0x8000000000000000ull;
+        };
+
+        template <typename T> struct allocation_base_t
+        {
+            static constexpr T   NO_SPACE = (T)~(T)0;
+            static constexpr u32 NO_NODE  = 0xffffffff;
 
-            u32 offset   = NO_SPACE;
-            u32 metadata = NO_SPACE;  // internal: node index
+            T   offset   = NO_SPACE;
+            u32 metadata = NO_NODE;  // internal: node index
         };
+        template <typename T> constexpr T   allocation_base_t<T>::NO_SPACE;
+        template <typename T> constexpr u32 allocation_base_t<T>::NO_NODE;
 
-        struct storage_report_t
+        template <typename T> struct storage_report_base_t
         {
-            u32 totalFreeSpace;
-            u32 largestFreeRegion;
+            T totalFreeSpace;
+            T largestFreeRegion;
         };
 
-        struct full_storage_report_t
+        template <typename T> struct full_storage_report_base_t
         {
             struct region_t
             {
-                u32 size;
+                T   size;
                 u32 count;
             };
 
-            region_t freeRegions[NUM_LEAF_BINS];
+            region_t freeRegions[offset_traits_t<T>::NUM_LEAF_BINS];
+        };
+
+        // A move of a live allocation as computed by the defragmentation planner
+        template <typename T> struct defrag_move_base_t
+        {
+            T   from;      // current offset
+            T   to;        // new offset, lower than 'from'
+            T   size;
+            u32 metadata;  // allocation_t::metadata, stays the same
+        };
+
+        struct node_neighbor_t
+        {
+            u32 prev;
+            u32 next;
+        };
+
+        // Node layouts of the allocator. The split layout keeps the neighbor links in a separate array,
+        // the compact layout has one array of nodes whose neighbor links are always valid and whose other
+        // two fields hold the offset and size of a used node or the bin list links of a free node. The
+        // offset and size of a free node follow from its neighbors, which are used nodes since free
+        // neighbors are always merged.
+        template <typename T, bool COMPACT> struct node_layout_t;
+
+        template <typename T> struct node_layout_t<T, false>
+        {
+            static constexpr bool NEIGHBORS = true;  // separate neighbor array
+
+            struct node_t
+            {
+                static constexpr u32 NIL = 0xffffffff;
+
+                T   dataOffset  = 0;
+                T   dataSize    = 0;
+                u32 binListPrev = NIL;
+                u32 binListNext = NIL;
+            };
+
+            static inline u32& neighborPrev(node_t*, node_neighbor_t* neighbors, u32 i) { return neighbors[i].prev; }
+            static inline u32& neighborNext(node_t*, node_neighbor_t* neighbors, u32 i) { return neighbors[i].next; }
+            static inline u32  binListPrev(node_t const* nodes, u32 i) { return nodes[i].binListPrev; }
+            static inline u32  binListNext(node_t const* nodes, u32 i) { return nodes[i].binListNext; }
+            static inline void setBinListPrev(node_t* nodes, u32 i, u32 v) { nodes[i].binListPrev = v; }
+            static inline void setBinListNext(node_t* nodes, u32 i, u32 v) { nodes[i].binListNext = v; }
+            static inline void setFreeNode(node_t* nodes, u32 i, T offset, T size)
+            {
+                nodes[i].dataOffset = offset;
+                nodes[i].dataSize   = size;
+            }
+            static inline T freeNodeOffset(node_t const* nodes, u32 i) { return nodes[i].dataOffset; }
+            static inline T freeNodeSize(node_t const* nodes, u32 i, T, T) { return nodes[i].dataSize; }
+        };
+
+        template <typename T> struct node_layout_t<T, true>
+        {
+            static constexpr bool NEIGHBORS = false;
+
+            struct node_t
+            {
+                static constexpr u32 NIL = 0xffffffff;
+
+                u32 prev       = NIL;  // neighbor
+                u32 next       = NIL;  // neighbor
+                T   dataOffset = 0;    // free: bin list prev
+                T   dataSize   = 0;    // free: bin list next
+            };
+
+            static inline u32& neighborPrev(node_t* nodes, node_neighbor_t*, u32 i) { return nodes[i].prev; }
+            static inline u32& neighborNext(node_t* nodes, node_neighbor_t*, u32 i) { return nodes[i].next; }
+            static inline u32  binListPrev(node_t const* nodes, u32 i) { return (u32)nodes[i].dataOffset; }
+            static inline u32  binListNext(node_t const* nodes, u32 i) { return (u32)nodes[i].dataSize; }
+            static inline void setBinListPrev(node_t* nodes, u32 i, u32 v) { nodes[i].dataOffset = v; }
+            static inline void setBinListNext(node_t* nodes, u32 i, u32 v) { nodes[i].dataSize = v; }
+            static inline void setFreeNode(node_t*, u32, T, T) {}  // derived from the neighbors
+            static inline T    freeNodeOffset(node_t const* nodes, u32 i) { return nodes[i].prev == node_t::NIL ? 0 : (nodes[nodes[i].prev].dataOffset + nodes[nodes[i].prev].dataSize); }
+            static inline T    freeNodeSize(node_t const* nodes, u32 i, T offset, T size) { return (nodes[i].next == node_t::NIL ? size : nodes[nodes[i].next].dataOffset) - offset; }
         };
 
-        class allocator_t
+        // 'COMPACT' selects the node layout, see node_layout_t
+        template <typename T, bool COMPACT = false> class allocator_base_t
         {
         public:
-            allocator_t(alloc_t* allocator, u32 size, u32 maxAllocs = 128 * 1024);
-            allocator_t(allocator_t&& other);
-            ~allocator_t();
+            typedef allocation_base_t<T>          allocation_type;
+            typedef storage_report_base_t<T>      storage_report_type;
+            typedef full_storage_report_base_t<T> full_storage_report_type;
+            typedef defrag_move_base_t<T>         defrag_move_type;
+
+            // 'maxAllocs' is the maximum number of nodes (0 = no limit), the node arrays start with 'initialAllocs'
+            // nodes and grow geometrically up to that, node indices (allocation metadata) stay valid when they grow.
+            allocator_base_t(alloc_t* allocator, T size, u32 maxAllocs = 128 * 1024, u32 initialAllocs = 1024);
+            allocator_base_t(allocator_base_t&& other);
+            ~allocator_base_t();
 
             void setup();
             void teardown();
             void reset();
 
-            allocation_t          allocate(u32 size);
-            void                  free(allocation_t allocation);
-            u32                   allocationSize(allocation_t allocation) const;
-            storage_report_t      storageReport() const;
-            full_storage_report_t storageReportFull() const;
+            allocation_type          allocate(T size, T alignment = 1);  // alignment (power of two) of the offset
+            void                     free(allocation_type allocation);
+            T                        allocationSize(allocation_type allocation) const;
+
+            // Deferred free, the allocation stays in use until retire() is called with a completed fence
+            // that is equal or larger than 'fence'. Fences passed to free() should not decrease. Returns
+            // false when the queue could not grow, the allocation is then still in use.
+            bool free(allocation_type allocation, u64 fence);
+            u32  retire(u64 completedFence);  // releases the deferred frees up to 'completedFence', returns the count
+            u32  pendingFrees() const { return m_pendingCount; }
+
+            // Defragmentation, planDefrag() computes moves that slide live allocations towards offset 0 in
+            // address order until 'maxMoves' or 'moveBudget' bytes are reached. A moved allocation keeps the
+            // natural alignment of its offset, a non-zero 'alignment' caps it and should be at least the largest
+            // alignment passed to allocate(). The caller copies the data in the order of the moves (memmove,
+            // ranges may overlap) and then calls commitDefrag() with the same moves, before any other allocate
+            // or free. Deferred frees that are still pending are not moved, nothing slides across them.
+            u32  planDefrag(defrag_move_type* moves, u32 maxMoves, T moveBudget, T alignment = 0) const;
+            void commitDefrag(defrag_move_type const* moves, u32 count);
+
+            // Persistent state, save() writes the nodes, bins, counters and pending deferred frees to a blob
+            // without pointers (only offsets and node indices) that can be stored with the managed range.
+            // load() restores it with a few copies and can be called instead of setup(), the size of the range
+            // must match. The blob is native endian and only loads with the same offset type and node layout.
+            u64  saveSize() const;
+            u64  save(void* buffer, u64 bufferSize) const;  // returns the bytes written, 0 if the buffer is too small
+            bool load(void const* buffer, u64 bufferSize);  // returns false if the blob does not match
+
+            storage_report_type      storageReport() const;
+            full_storage_report_type storageReportFull() const;
 
             DCORE_CLASS_PLACEMENT_NEW_DELETE
 
         private:
-            u32  insertNodeIntoBin(u32 size, u32 dataOffset);
+            typedef typename offset_traits_t<T>::mask_t mask_t;
+            static constexpr u32                        NUM_TOP_BINS  = offset_traits_t<T>::NUM_TOP_BINS;
+            static constexpr u32                        NUM_LEAF_BINS = offset_traits_t<T>::NUM_LEAF_BINS;
+
+            struct blob_header_t;
+
+            u32  insertNodeIntoBin(T size, T dataOffset);
             void removeNodeFromBin(u32 nodeIndex);
+            bool reserveNodes(u32 count);
+            bool growNodes();
+            bool growPending();
 
             inline bool isNodeUsed(u32 index) const { return (m_nodeUsed[index >> 5] & (1 << (index & 31))) != 0; }
             inline void setNodeUsed(u32 index) { m_nodeUsed[index >> 5] |= (1 << (index & 31)); }
             inline void setNodeUnused(u32 index) { m_nodeUsed[index >> 5] &= ~(1 << (index & 31)); }
+            inline bool isNodePending(u32 index) const { return (m_nodeUsed[(m_maxAllocs >> 5) + (index >> 5)] & (1 << (index & 31))) != 0; }
+            inline void setNodePending(u32 index) { m_nodeUsed[(m_maxAllocs >> 5) + (index >> 5)] |= (1 << (index & 31)); }
+            inline void setNodeNotPending(u32 index) { m_nodeUsed[(m_maxAllocs >> 5) + (index >> 5)] &= ~(1 << (index & 31)); }
 
-            struct node_t
-            {
-                static constexpr u32 NIL = 0xffffffff;
-
-                u32 dataOffset  = 0;
-                u32 dataSize    = 0;
-                u32 binListPrev = NIL;
-                u32 binListNext = NIL;
-            };
+            typedef node_layout_t<T, COMPACT> layout_t;
+            typedef typename layout_t::node_t node_t;
+            typedef node_neighbor_t           neighbor_t;
 
-            struct neighbor_t
-            {
-                u32 prev;
-                u32 next;
-            };
+            inline u32& neighborPrev(u32 i) { return layout_t::neighborPrev(m_nodes, m_neighbors, i); }
+            inline u32& neighborNext(u32 i) { return layout_t::neighborNext(m_nodes, m_neighbors, i); }
+            inline u32  neighborPrev(u32 i) const { return layout_t::neighborPrev(m_nodes, m_neighbors, i); }
+            inline u32  neighborNext(u32 i) const { return layout_t::neighborNext(m_nodes, m_neighbors, i); }
+            inline u32  binListPrev(u32 i) const { return layout_t::binListPrev(m_nodes, i); }
+            inline u32  binListNext(u32 i) const { return layout_t::binListNext(m_nodes, i); }
+            inline void setBinListPrev(u32 i, u32 v) { layout_t::setBinListPrev(m_nodes, i, v); }
+            inline void setBinListNext(u32 i, u32 v) { layout_t::setBinListNext(m_nodes, i, v); }
+            inline T    freeNodeOffset(u32 i) const { return layout_t::freeNodeOffset(m_nodes, i); }
+            inline T    freeNodeSize(u32 i, T offset) const { return layout_t::freeNodeSize(m_nodes, i, offset, m_size); }
 
             alloc_t*    m_allocator;
-            u32         m_size;
-            u32         m_maxAllocs;
-            u32         m_freeStorage;
-            u32         m_usedBinsTop;
+            T           m_size;
+            u32         m_maxAllocs;      // current capacity of the node arrays
+            u32         m_initialAllocs;  // capacity after setup
+            u32         m_limitAllocs;    // upper bound of the capacity
+            T           m_freeStorage;
+            mask_t      m_usedBinsTop;
             u8          m_usedBins[NUM_TOP_BINS];
             u32         m_binIndices[NUM_LEAF_BINS];
             node_t*     m_nodes;
-            neighbor_t* m_neighbors;
-            u32*        m_nodeUsed;
+            neighbor_t* m_neighbors;  // only with the split layout
+            u32*        m_nodeUsed;  // used bits, followed by the pending (deferred free) bits
             u32         m_freeIndex;
             u32         m_freeListHead;
             u32         m_freeOffset;
+
+            struct pending_t
+            {
+                u64 fence;
+                u32 nodeIndex;
+            };
+
+            pending_t* m_pending;  // ring buffer of deferred frees, ordered by fence
+            u32        m_pendingCapacity;
+            u32        m_pendingHead;
+            u32        m_pendingCount;
+        };
+
+        // 32-bit offsets and sizes, ranges below 2 GB
+        typedef allocation_base_t<u32>          allocation_t;
+        typedef storage_report_base_t<u32>      storage_report_t;
+        typedef full_storage_report_base_t<u32> full_storage_report_t;
+        typedef allocator_base_t<u32>           allocator_t;
+        typedef defrag_move_base_t<u32>         defrag_move_t;
+
+        // 64-bit offsets and sizes, for ranges of 2 GB and larger
+        typedef allocation_base_t<u64>          allocation64_t;
+        typedef storage_report_base_t<u64>      storage_report64_t;
+        typedef full_storage_report_base_t<u64> full_storage_report64_t;
+        typedef allocator_base_t<u64>           allocator64_t;
+        typedef defrag_move_base_t<u64>         defrag_move64_t;
+
+        // Compact node layout, a third less node memory, see node_layout_t
+        typedef allocator_base_t<u32, true> allocator_compact_t;
+        typedef allocator_base_t<u64, true> allocator64_compact_t;
+
+        // Thread-safe variant, the range is split into independent allocator_t shards that each have
+        // their own lock. A thread allocates from its home shard and falls back to the other shards
+        // when that shard is out of space, the shard is encoded in the top bits of allocation_t::metadata
+        // so that free() goes straight to the owning shard. Shards grow their nodes through 'allocator'
+        // under a lock that they share, the allocator does not need to be thread-safe.
+        class sharded_allocator_t
+        {
+        public:
+            static constexpr u32 MAX_SHARDS      = 64;
+            static constexpr u32 SHARD_SHIFT     = 24;         // metadata = (shard << SHARD_SHIFT) | node index
+            static constexpr u32 SHARD_ALIGNMENT = 64 * 1024;  // start of a shard, an upper bound for the alignment
+
+            sharded_allocator_t(alloc_t* allocator, u32 size, u32 numShards, u32 initialAllocs = 8 * 1024);
+            ~sharded_allocator_t();
+
+            void setup();
+            void teardown();
+            void reset();  // not thread-safe
+
+            allocation_t     allocate(u32 size, u32 alignment = 1);
+            void             free(allocation_t allocation);
+            u32              allocationSize(allocation_t allocation) const;
+            storage_report_t storageReport() const;
+            u32              shardCount() const { return m_numShards; }
+            u32              homeShard() const;
+
+            DCORE_CLASS_PLACEMENT_NEW_DELETE
+
+        private:
+            struct shard_t;
+            struct locked_alloc_t;
+
+            alloc_t*        m_allocator;
+            locked_alloc_t* m_shardAllocator;  // m_allocator behind the shared lock, used by the shards
+            u32             m_size;
+            u32             m_initialAllocs;
+            u32             m_numShards;
+            shard_t*        m_shards;
         };
     }  // namespace ngfx
 }  // namespace ncore
@@ -41,7 +41,7 @@ namespace ncore
     namespace nsegward
     {
         struct allocator_t;
-        allocator_t* create(int_t segment_size, int_t total_size);
+        allocator_t* create(int_t segment_size, int_t total_size, bool huge_pages = false); // huge pages: segments >= 2 MB, 2 MB aligned, THP (Linux)
         void         destroy(allocator_t* allocator);
         void*        allocate(allocator_t* a, u32 size, u32 alignment);
         void         deallocate(allocator_t* a, void* ptr);
@@ -0,0 +1,325 @@
+// Timing runs of the heap and offset allocators that print their results, they are not part of
+// the unit tests. Define ALLOCATOR_BENCHMARKS to build them into the unittest.
+#ifdef ALLOCATOR_BENCHMARKS
+
+#include "ccore/c_allocator.h"
+#include "ccore/c_memory.h"
+#include "callocator/c_allocator_heap.h"
+#include "callocator/c_allocator_offset.h"
+
+#include "cunittest/cunittest.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+using namespace ncore;
+
+UNITTEST_SUITE_BEGIN(benchmark)
+{
+    UNITTEST_FIXTURE(heap)
+    {
+        UNITTEST_ALLOCATOR;
+
+        static void s_tcache_worker(heap_t* heap, s32 iterations)
+        {
+            heap_tcache_t* cache = g_heap_tcache_create(heap);
+            void*          ptrs[64];
+            for (s32 n = 0; n < iterations; ++n)
+            {
+                for (u32 i = 0; i < 64; ++i)
+                    ptrs[i] = g_heap_tcache_alloc(cache, 16 + ((i * 24) & 127));
+                for (u32 i = 0; i < 64; ++i)
+                    g_heap_tcache_dealloc(cache, ptrs[i]);
+            }
+            g_heap_tcache_destroy(cache);
+        }
+
+        // Bookkeeping churn as done by the allocators that take an alloc_t, an offset allocator
+        // that is set up and torn down plus a mix of small and medium sized allocations.
+        static double s_backing_workload(alloc_t* backing, s32 rounds)
+        {
+            void*      ptrs[256];
+            auto const start = std::chrono::high_resolution_clock::now();
+            for (s32 r = 0; r < rounds; ++r)
+            {
+                noffset::allocator_t offset(backing, 1024 * 1024, 4 * 1024);
+                offset.setup();
+                offset.teardown();
+
+                for (u32 i = 0; i < 256; ++i)
+                    ptrs[i] = backing->allocate(16 + ((i * 40) & 1023), (i & 3) == 0 ? 64 : 8);
+                for (u32 i = 0; i < 256; i += 2)
+                    backing->deallocate(ptrs[i]);
+                for (u32 i = 0; i < 256; i += 2)
+                    ptrs[i] = backing->allocate(32 + ((i * 72) & 2047));
+                for (u32 i = 0; i < 256; ++i)
+                    backing->deallocate(ptrs[i]);
+            }
+            auto const end = std::chrono::high_resolution_clock::now();
+            return std::chrono::duration<double>(end - start).count();
+        }
+
+        // A recorded trace, a deterministic sequence of mixed-size allocations with random lifetimes,
+        // replayed against a heap. Returns the duration, the peak footprint is the highest address in
+        // use relative to the start of the heap.
+        struct trace_op_t
+        {
+            u32 m_size; // 0 = free the allocation in slot m_slot
+            u32 m_slot;
+        };
+
+        static void s_record_trace(trace_op_t* ops, u32 count, u32 slots)
+        {
+            u32 rnd = 0x2545F491;
+            for (u32 i = 0; i < count; ++i)
+            {
+                rnd ^= rnd << 13;
+                rnd ^= rnd >> 17;
+                rnd ^= rnd << 5;
+                ops[i].m_slot = rnd % slots;
+                const u32 kind = (rnd >> 8) % 8;
+                ops[i].m_size  = kind < 5 ? 192 + ((rnd >> 12) % 1024) : kind < 7 ? 2048 + ((rnd >> 12) % 8192) : 16384 + ((rnd >> 12) % 49152);
+            }
+        }
+
+        static double s_replay_trace(heap_t* heap, trace_op_t const* ops, u32 count, void** slots, u32 num_slots, int_t& peak)
+        {
+            for (u32 i = 0; i < num_slots; ++i)
+                slots[i] = nullptr;
+            peak = 0;
+
+            auto const start = std::chrono::high_resolution_clock::now();
+            for (u32 i = 0; i < count; ++i)
+            {
+                // An occupied slot is freed, an empty slot is allocated
+                void*& slot = slots[ops[i].m_slot];
+                if (slot)
+                {
+                    g_heap_dealloc(heap, slot);
+                    slot = nullptr;
+                    continue;
+                }
+                slot             = g_heap_alloc(heap, ops[i].m_size);
+                const int_t used = (int_t)((char*)slot + ops[i].m_size - (char*)heap->m_save_point);
+                if (used > peak)
+                    peak = used;
+            }
+            auto const end = std::chrono::high_resolution_clock::now();
+
+            for (u32 i = 0; i < num_slots; ++i)
+                g_heap_dealloc(heap, slots[i]);
+            return std::chrono::duration<double>(end - start).count();
+        }
+
+        // Random reads over a large working set, dominated by TLB misses when backed by 4 KB pages
+        static double s_tlb_workload(heap_t* heap, int_t size, u32 reads)
+        {
+            u64*        data  = (u64*)g_heap_alloc_aligned(heap, size, 64);
+            const u32   count = (u32)(size / sizeof(u64));
+            for (u32 i = 0; i < count; ++i)
+                data[i] = i;
+
+            u64        sum = 0;
+            u32        rnd = 0x9E3779B9;
+            auto const start = std::chrono::high_resolution_clock::now();
+            for (u32 i = 0; i < reads; ++i)
+            {
+                rnd ^= rnd << 13;
+                rnd ^= rnd >> 17;
+                rnd ^= rnd << 5;
+                sum += data[rnd % count];
+            }
+            auto const end = std::chrono::high_resolution_clock::now();
+
+            g_heap_dealloc(heap, data);
+            return sum == 0 ? 0.0 : std::chrono::duration<double>(end - start).count();
+        }
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        // The same TLB heavy workload on a heap with and without transparent huge pages, once as a
+        // huge allocation (its own arena) and once from the heap region (huge threshold disabled)
+        UNITTEST_TEST(huge_pages_tlb)
+        {
+            const int_t size  = 256 * 1024 * 1024;
+            const u32   reads = 8 * 1024 * 1024;
+            for (u32 region = 0; region < 2; ++region)
+            {
+                for (u32 i = 0; i < 2; ++i)
+                {
+                    heap_t* heap = g_heap_create(4 * 1024 * 1024, 512 * 1024 * 1024, i == 1);
+                    if (region == 1)
+                        g_heap_set_huge_threshold(heap, 0);
+                    const double seconds = s_tlb_workload(heap, size, reads);
+                    printf("heap %s, %s pages: %.2f ns/read\n", region == 1 ? "region" : "huge allocation", i == 1 ? "huge" : "4 KB", seconds * 1e9 / reads);
+                    g_heap_release(heap);
+                }
+            }
+        }
+
+        // Good-fit vs. best-fit with different scan bounds on the same trace, peak footprint vs. time
+        UNITTEST_TEST(best_fit_trace)
+        {
+            const u32   count     = 200000;
+            const u32   num_slots = 2048;
+            trace_op_t* ops       = g_allocate_array<trace_op_t>(Allocator, count);
+            void**      slots     = g_allocate_array<void*>(Allocator, num_slots);
+            s_record_trace(ops, count, num_slots);
+
+            const u32 scans[] = {0, 4, 16, 64};
+            for (u32 i = 0; i < g_array_size(scans); ++i)
+            {
+                heap_t* heap = g_heap_create(16 * 1024 * 1024, 256 * 1024 * 1024);
+                g_heap_set_best_fit(heap, scans[i]);
+                int_t        peak    = 0;
+                const double seconds = s_replay_trace(heap, ops, count, slots, num_slots, peak);
+                printf("heap fit (scan %u): peak %.2f MB, %.1f ns/op\n", scans[i], (double)peak / (1024.0 * 1024.0), seconds * 1e9 / count);
+                g_heap_release(heap);
+            }
+
+            Allocator->deallocate(slots);
+            Allocator->deallocate(ops);
+        }
+
+        // The same workload backed by the system allocator and by a heap through heap_alloc_t
+        UNITTEST_TEST(alloc_backing)
+        {
+            const s32 rounds = 200;
+
+            const double system_seconds = s_backing_workload(Allocator, rounds);
+
+            alloc_t*     heap         = g_create_heap(4 * 1024 * 1024, 64 * 1024 * 1024);
+            const double heap_seconds = s_backing_workload(heap, rounds);
+            g_release_heap(heap);
+
+            printf("alloc backing: system %.3f ms, heap %.3f ms\n", system_seconds * 1000.0, heap_seconds * 1000.0);
+        }
+
+        // Throughput of the thread cache with 1 to N threads sharing one heap, each thread
+        // executes the same amount of work so ideal scaling shows a constant duration.
+        UNITTEST_TEST(tcache_scaling)
+        {
+            const s32 iterations = 2000;
+            u32       max_threads = std::thread::hardware_concurrency();
+            if (max_threads == 0 || max_threads > 8)
+                max_threads = 8;
+
+            for (u32 num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+            {
+                heap_t*     heap = g_heap_create(4 * 1024 * 1024, 64 * 1024 * 1024);
+                std::thread threads[8];
+
+                auto const start = std::chrono::high_resolution_clock::now();
+                for (u32 i = 0; i < num_threads; ++i)
+                    threads[i] = std::thread(s_tcache_worker, heap, iterations);
+                for (u32 i = 0; i < num_threads; ++i)
+                    threads[i].join();
+                auto const end = std::chrono::high_resolution_clock::now();
+
+                const double seconds = std::chrono::duration<double>(end - start).count();
+                const double ops     = (double)num_threads * iterations * 64 * 2;
+                printf("heap tcache: %u thread(s), %.1f Mops/s\n", num_threads, ops / seconds / 1000000.0);
+
+                g_heap_release(heap);
+            }
+        }
+    }
+
+    UNITTEST_FIXTURE(offset)
+    {
+        UNITTEST_ALLOCATOR;
+
+        template <typename A> static double s_churn(A& alloc, u32 rounds)
+        {
+            typename A::allocation_type allocations[256];
+            auto const                  start = std::chrono::high_resolution_clock::now();
+            for (u32 r = 0; r < rounds; ++r)
+            {
+                for (u32 i = 0; i < 256; ++i)
+                    allocations[i] = alloc.allocate(64 + ((i * 40) & 4095));
+                for (u32 i = 0; i < 256; i += 2)
+                    alloc.free(allocations[i]);
+                for (u32 i = 0; i < 256; i += 2)
+                    allocations[i] = alloc.allocate(32 + ((i * 72) & 8191));
+                for (u32 i = 0; i < 256; ++i)
+                    alloc.free(allocations[i]);
+            }
+            auto const end = std::chrono::high_resolution_clock::now();
+            return std::chrono::duration<double>(end - start).count();
+        }
+
+        // Random replacement over a large number of live allocations, the node arrays do not fit in the cache
+        template <typename A> static double s_random_churn(A& alloc, typename A::allocation_type* allocations, u32 count, u32 ops)
+        {
+            for (u32 i = 0; i < count; ++i)
+                allocations[i] = alloc.allocate(64 + ((i * 40) & 1023));
+
+            u32        rnd   = 0x2545F491;
+            auto const start = std::chrono::high_resolution_clock::now();
+            for (u32 n = 0; n < ops; ++n)
+            {
+                rnd ^= rnd << 13;
+                rnd ^= rnd >> 17;
+                rnd ^= rnd << 5;
+                const u32 i = rnd % count;
+                alloc.free(allocations[i]);
+                allocations[i] = alloc.allocate(64 + ((rnd >> 8) & 1023));
+            }
+            auto const end = std::chrono::high_resolution_clock::now();
+
+            for (u32 i = 0; i < count; ++i)
+                alloc.free(allocations[i]);
+            return std::chrono::duration<double>(end - start).count();
+        }
+
+        template <typename A, typename T> static void s_small_set(alloc_t* allocator, T size, const char* name)
+        {
+            const u32 maxAllocs = 64 * 1024;
+            const u32 rounds    = 2000;
+            A         alloc(allocator, size, maxAllocs, maxAllocs);
+            alloc.setup();
+            const double seconds = s_churn(alloc, rounds);
+            printf("offset %s: %.1f ns/op\n", name, seconds * 1e9 / (rounds * 512.0));
+            alloc.teardown();
+        }
+
+        template <typename A> static void s_working_set(alloc_t* allocator, const char* name)
+        {
+            const u32 count = 512 * 1024;
+            const u32 ops   = 2 * 1024 * 1024;
+
+            typename A::allocation_type* allocations = g_allocate_array<typename A::allocation_type>(allocator, count);
+            A                            alloc(allocator, 1024 * 1024 * 1024, count * 2, count * 2);
+            alloc.setup();
+            const double seconds = s_random_churn(alloc, allocations, count, ops);
+            printf("offset %s: %u live, %.1f ns/op\n", name, count, seconds * 1e9 / (ops * 2.0));
+            CHECK_EQUAL((u32)1024 * 1024 * 1024, alloc.storageReport().totalFreeSpace);
+            alloc.teardown();
+            allocator->deallocate(allocations);
+        }
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        // Allocate/free throughput of the 32-bit and 64-bit offset allocators in both node layouts
+        UNITTEST_TEST(small_working_set)
+        {
+            s_small_set<ncore::noffset::allocator_t>(Allocator, (u32)1024 * 1024 * 1024, "32-bit (split)");
+            s_small_set<ncore::noffset::allocator_compact_t>(Allocator, (u32)1024 * 1024 * 1024, "32-bit (compact)");
+            s_small_set<ncore::noffset::allocator64_t>(Allocator, (u64)64 * 1024 * 1024 * 1024, "64-bit (split)");
+            s_small_set<ncore::noffset::allocator64_compact_t>(Allocator, (u64)64 * 1024 * 1024 * 1024, "64-bit (compact)");
+        }
+
+        // Allocate/free throughput with a working set of live nodes that is larger than the cache
+        UNITTEST_TEST(large_working_set)
+        {
+            s_working_set<ncore::noffset::allocator_t>(Allocator, "32-bit (split)");
+            s_working_set<ncore::noffset::allocator_compact_t>(Allocator, "32-bit (compact)");
+        }
+    }
+}
+UNITTEST_SUITE_END
+
+#endif
@@ -1,12 +1,22 @@
 #include "ccore/c_allocator.h"
 #include "ccore/c_memory.h"
 #include "callocator/c_allocator_heap.h"
+#include "callocator/c_allocator_offset.h"
 
 #include "cunittest/cunittest.h"
 
+#include <thread>
+
 using namespace ncore;
 
-UNITTEST_SUITE_BEGIN(heap)
+// The variant test files compile this suite again under their own name, with the heap built in
+// the configuration that they define
+#ifndef HEAP_TEST_SUITE
+#    define HEAP_TEST_SUITE heap
+#endif
+#define HEAP_TEST_SUITE_BEGIN(name) UNITTEST_SUITE_BEGIN(name)
+
+HEAP_TEST_SUITE_BEGIN(HEAP_TEST_SUITE)
 {
     UNITTEST_FIXTURE(main)
     {
@@ -140,6 +150,738 @@ UNITTEST_SUITE_BEGIN(heap)
 
             g_release_heap(tlsf);
         }
+
+        UNITTEST_TEST(tcache_alloc_dealloc)
+        {
+            heap_t*        heap  = g_heap_create(gInitSize, gBlockSize);
+            heap_tcache_t* cache = g_heap_tcache_create(heap);
+            CHECK_NOT_NULL(cache);
+
+            void* ptrs[256];
+            for (u32 i = 0; i < 256; ++i)
+            {
+                ptrs[i] = g_heap_tcache_alloc(cache, 1 + (i * 7) % 300);
+                CHECK_NOT_NULL(ptrs[i]);
+                nmem::memset(ptrs[i], 0xa5, 1 + (i * 7) % 300);
+            }
+            for (u32 i = 0; i < 256; ++i)
+                g_heap_tcache_dealloc(cache, ptrs[i]);
+
+            // Cached blocks are handed out again without going back to the shared heap
+            void* again = g_heap_tcache_alloc(cache, 64);
+            CHECK_NOT_NULL(again);
+            g_heap_tcache_dealloc(cache, again);
+
+            g_heap_tcache_destroy(cache);
+            g_heap_release(heap);
+        }
+
+        UNITTEST_TEST(tcache_keeps_every_class)
+        {
+            heap_t*        heap  = g_heap_create(gInitSize, gBlockSize);
+            heap_tcache_t* cache = g_heap_tcache_create(heap);
+
+            // A block that goes back into its size-class is the next one handed out. The first block of a
+            // refill may hold the remainder of the carved block, the second one has the size of its class.
+            for (u32 size = 16; size <= 256; size += 16)
+            {
+                void* first = g_heap_tcache_alloc(cache, size);
+                void* ptr   = g_heap_tcache_alloc(cache, size);
+                CHECK_NOT_NULL(ptr);
+                g_heap_tcache_dealloc(cache, ptr);
+                void* again = g_heap_tcache_alloc(cache, size);
+                CHECK_EQUAL(ptr, again);
+                g_heap_tcache_dealloc(cache, again);
+                g_heap_tcache_dealloc(cache, first);
+            }
+
+            g_heap_tcache_destroy(cache);
+            g_heap_release(heap);
+        }
+    }
+
+    UNITTEST_FIXTURE(resize)
+    {
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(expand_and_shrink_in_place)
+        {
+            heap_t* heap = g_heap_create(1024 * 1024, 16 * 1024 * 1024);
+
+            // Sizes above the slab size-classes, so these are blocks that can be resized
+            u8* a = (u8*)g_heap_alloc(heap, 256);
+            u8* b = (u8*)g_heap_alloc(heap, 512);
+            u8* c = (u8*)g_heap_alloc(heap, 256);
+            for (u32 i = 0; i < 256; ++i)
+                a[i] = (u8)i;
+
+            // 'b' is in use, 'a' cannot grow in place
+            CHECK_FALSE(g_heap_try_expand(heap, a, 512));
+
+            // With 'b' released 'a' can absorb it
+            g_heap_dealloc(heap, b);
+            CHECK_TRUE(g_heap_try_expand(heap, a, 768));
+            for (u32 i = 0; i < 256; ++i)
+                CHECK_EQUAL((u8)i, a[i]);
+
+            // Shrinking gives the tail back, so it can be reused
+            g_heap_shrink(heap, a, 256);
+            u8* d = (u8*)g_heap_alloc(heap, 384);
+            CHECK_TRUE(d > a && d < c);
+
+            // The last block can grow by growing the arena
+            u8* e = (u8*)g_heap_alloc(heap, 4096);
+            CHECK_TRUE(g_heap_try_expand(heap, e, 64 * 1024));
+
+            g_heap_dealloc(heap, e);
+            g_heap_dealloc(heap, d);
+            g_heap_dealloc(heap, c);
+            g_heap_dealloc(heap, a);
+            g_heap_release(heap);
+        }
+
+        UNITTEST_TEST(usable_size_and_sized_dealloc)
+        {
+            heap_t* heap = g_heap_create(1024 * 1024, 16 * 1024 * 1024);
+
+            const u32 sizes[] = {1, 20, 100, 129, 1000, 5000, 70000};
+            void*     ptrs[7];
+            for (u32 i = 0; i < 7; ++i)
+            {
+                ptrs[i]    = g_heap_alloc(heap, sizes[i]);
+                u32 usable = g_heap_usable_size(heap, ptrs[i]);
+                CHECK_TRUE(usable >= sizes[i]);
+                nmem::memset(ptrs[i], 0xCD, usable); // all of it can be used
+            }
+            CHECK_EQUAL((u32)32, g_heap_usable_size(heap, ptrs[1]));
+
+            // Any size between the requested and the usable size is accepted
+            for (u32 i = 0; i < 7; ++i)
+                g_heap_dealloc_sized(heap, ptrs[i], (i & 1) ? sizes[i] : g_heap_usable_size(heap, ptrs[i]));
+
+            // Small aligned allocations that are not served by a slab
+            void* aligned = g_heap_alloc_aligned(heap, 64, 256);
+            g_heap_dealloc_sized(heap, aligned, 64);
+
+            g_heap_release(heap);
+        }
+
+        UNITTEST_TEST(realloc_keeps_content)
+        {
+            heap_t* heap = g_heap_create(1024 * 1024, 16 * 1024 * 1024);
+
+            u8* a = (u8*)g_heap_alloc(heap, 16);
+            u8* b = (u8*)g_heap_alloc(heap, 16);
+            for (u32 i = 0; i < 16; ++i)
+                a[i] = (u8)(i + 1);
+
+            // 'b' blocks in place growth, so this one relocates
+            u8* r = (u8*)g_heap_realloc(heap, a, 1000);
+            CHECK_NOT_NULL(r);
+            CHECK_TRUE(r != a);
+            for (u32 i = 0; i < 16; ++i)
+                CHECK_EQUAL((u8)(i + 1), r[i]);
+
+            // Shrinking through realloc never moves
+            CHECK_EQUAL(r, (u8*)g_heap_realloc(heap, r, 100));
+
+            g_heap_dealloc(heap, r);
+            g_heap_dealloc(heap, b);
+            g_heap_release(heap);
+        }
+    }
+
+    UNITTEST_FIXTURE(aligned)
+    {
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(alloc_aligned)
+        {
+            heap_t* heap = g_heap_create(1024 * 1024, 16 * 1024 * 1024);
+
+            const u32 aligns[] = {8, 16, 32, 64, 256, 4096};
+            void*     ptrs[6 * 4];
+            for (u32 i = 0; i < 6; ++i)
+            {
+                for (u32 j = 0; j < 4; ++j)
+                {
+                    // Sizes do not need to be a multiple of the alignment
+                    void* ptr = g_heap_alloc_aligned(heap, 24 + j * 100, aligns[i]);
+                    CHECK_NOT_NULL(ptr);
+                    CHECK_EQUAL((uint_t)0, (uint_t)ptr & (aligns[i] - 1));
+                    ptrs[i * 4 + j] = ptr;
+                }
+            }
+
+            struct simd_t
+            {
+                alignas(32) f32 v[8];
+            };
+            simd_t* simd = g_allocate_array<simd_t>(heap, 16);
+            CHECK_EQUAL((uint_t)0, (uint_t)simd & 31);
+            f32* io = g_allocate_array_and_clear<f32>(heap, 1000, 4096);
+            CHECK_EQUAL((uint_t)0, (uint_t)io & 4095);
+            CHECK_EQUAL(0.0f, io[999]);
+
+            g_deallocate(heap, io);
+            g_deallocate(heap, simd);
+            for (u32 i = 0; i < 6 * 4; ++i)
+                g_heap_dealloc(heap, ptrs[i]);
+            g_heap_release(heap);
+        }
+    }
+
+    UNITTEST_FIXTURE(slab)
+    {
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(small_sizes_share_a_slab)
+        {
+            heap_t* heap = g_heap_create(1024 * 1024, 16 * 1024 * 1024);
+
+            // Objects of one size-class are packed without a header, 16 byte aligned
+            u8* a = (u8*)g_heap_alloc(heap, 20);
+            u8* b = (u8*)g_heap_alloc(heap, 32);
+            CHECK_EQUAL((uint_t)32, (uint_t)(b - a));
+            CHECK_EQUAL((uint_t)0, (uint_t)a & 15);
+
+            // A freed object is handed out again first
+            g_heap_dealloc(heap, a);
+            CHECK_EQUAL(a, (u8*)g_heap_alloc(heap, 24));
+
+            // Fill more than a few slabs, free them all and do it again
+            void* ptrs[1024];
+            for (u32 i = 0; i < 1024; ++i)
+            {
+                ptrs[i] = g_heap_alloc(heap, 1 + (i & 127));
+                CHECK_NOT_NULL(ptrs[i]);
+                nmem::memset(ptrs[i], 0xCD, 1 + (i & 127));
+            }
+            for (u32 i = 0; i < 1024; ++i)
+                g_heap_dealloc(heap, ptrs[i]);
+            for (u32 i = 0; i < 1024; ++i)
+                ptrs[i] = g_heap_alloc(heap, 1 + (i & 127));
+            for (u32 i = 0; i < 1024; ++i)
+                g_heap_dealloc(heap, ptrs[(i * 7) & 1023]);
+
+            // Growing a slab object beyond its size-class moves it to a block
+            u8* r = (u8*)g_heap_realloc(heap, b, 1000);
+            CHECK_TRUE(r != b);
+            CHECK_FALSE(g_heap_try_expand(heap, a, 64));
+            CHECK_TRUE(g_heap_try_expand(heap, a, 32));
+
+            g_heap_dealloc(heap, r);
+            g_heap_dealloc(heap, a);
+            g_heap_release(heap);
+        }
+
+        UNITTEST_TEST(realloc_null_uses_a_slab)
+        {
+            heap_t* heap = g_heap_create(1024 * 1024, 16 * 1024 * 1024);
+
+            // Same as an allocation, packed next to the previous object of its size-class
+            u8* a = (u8*)g_heap_alloc(heap, 20);
+            u8* b = (u8*)g_heap_realloc(heap, nullptr, 32);
+            CHECK_EQUAL((uint_t)32, (uint_t)(b - a));
+            CHECK_NULL(g_heap_realloc(heap, nullptr, 0));
+
+            g_heap_dealloc(heap, b);
+            g_heap_dealloc(heap, a);
+            g_heap_release(heap);
+        }
+    }
+
+    UNITTEST_FIXTURE(pools)
+    {
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(grow_beyond_reservation)
+        {
+            // A small reservation, the heap adds pools when it runs out
+            heap_t* heap = g_heap_create(16 * 1024, 64 * 1024);
+
+            void* ptrs[16];
+            for (u32 i = 0; i < 16; ++i)
+            {
+                ptrs[i] = g_heap_alloc(heap, 200 * 1024);
+                CHECK_NOT_NULL(ptrs[i]);
+                nmem::memset(ptrs[i], 0xCD, 200 * 1024);
+            }
+            CHECK_NOT_NULL(heap->m_pools);
+
+            // Completely free pools are given back
+            for (u32 i = 0; i < 16; ++i)
+                g_heap_dealloc(heap, ptrs[i]);
+            CHECK_NULL(heap->m_pools);
+            g_heap_release(heap);
+        }
+
+        // With compact block headers static memory is, in general, too far away from the heap
+#ifndef TLSF_COMPACT_HEADER
+        UNITTEST_TEST(caller_memory)
+        {
+            heap_t* heap = g_heap_create(16 * 1024, 64 * 1024);
+
+            static u64 s_memory[(256 * 1024) / sizeof(u64)];
+            CHECK_TRUE(g_heap_add_pool(heap, s_memory, sizeof(s_memory)));
+
+            // Does not fit in the main region, so it comes from the pool
+            u8* ptr = (u8*)g_heap_alloc(heap, 128 * 1024);
+            CHECK_TRUE(ptr > (u8*)s_memory && ptr < (u8*)s_memory + sizeof(s_memory));
+
+            // A pool that is in use cannot be removed
+            CHECK_FALSE(g_heap_remove_pool(heap, s_memory));
+            g_heap_dealloc(heap, ptr);
+            CHECK_TRUE(g_heap_remove_pool(heap, s_memory));
+            CHECK_NULL(heap->m_pools);
+
+            g_heap_release(heap);
+        }
+#endif
+    }
+
+    UNITTEST_FIXTURE(purge)
+    {
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(purge_interior_pages)
+        {
+            heap_t* heap = g_heap_create(4 * 1024 * 1024, 16 * 1024 * 1024);
+
+            // 'b' keeps 'a' from being returned through the arena
+            u8* a = (u8*)g_heap_alloc(heap, 1024 * 1024);
+            u8* b = (u8*)g_heap_alloc(heap, 1024);
+            nmem::memset(a, 0xCD, 1024 * 1024);
+            g_heap_dealloc(heap, a);
+
+            int_t purged = g_heap_purge(heap);
+            CHECK_TRUE(purged >= 1024 * 1024 - 2 * 4096);
+
+            // Nothing was freed since, a second purge has nothing to do
+            CHECK_EQUAL((int_t)0, g_heap_purge(heap));
+
+            // The purged memory can be used again
+            u8* c = (u8*)g_heap_alloc(heap, 512 * 1024);
+            CHECK_EQUAL(a, c);
+            nmem::memset(c, 0xAB, 512 * 1024);
+            CHECK_EQUAL(0xAB, c[256 * 1024]);
+
+            // With a threshold the purge is done when enough memory has been freed
+            g_heap_set_purge_threshold(heap, 512 * 1024);
+            g_heap_dealloc(heap, c);
+            CHECK_EQUAL((int_t)0, heap->m_purge_dirty);
+
+            g_heap_dealloc(heap, b);
+            g_heap_release(heap);
+        }
+    }
+
+    UNITTEST_FIXTURE(huge)
+    {
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(huge_allocations_have_their_own_arena)
+        {
+            heap_t* heap = g_heap_create(1024 * 1024, 16 * 1024 * 1024);
+            g_heap_set_huge_threshold(heap, 1024 * 1024);
+
+            // Larger than the reservation of the heap, still no pool is needed
+            u8* a = (u8*)g_heap_alloc(heap, 32 * 1024 * 1024);
+            u8* b = (u8*)g_heap_alloc_aligned(heap, 2 * 1024 * 1024, 4096);
+            CHECK_NOT_NULL(a);
+            CHECK_NOT_NULL(b);
+            CHECK_NULL(heap->m_pools);
+            CHECK_EQUAL((uint_t)0, (uint_t)b & 4095);
+            a[32 * 1024 * 1024 - 1] = 1;
+
+            // A block that grows beyond the threshold becomes huge, and a huge allocation
+            // does not grow in place.
+            u8* c = (u8*)g_heap_alloc(heap, 1000);
+            c[999] = 0x5A;
+            c = (u8*)g_heap_realloc(heap, c, 3 * 1024 * 1024);
+            CHECK_EQUAL(0x5A, c[999]);
+            CHECK_FALSE(g_heap_try_expand(heap, c, 4 * 1024 * 1024));
+            CHECK_TRUE(g_heap_try_expand(heap, c, 2 * 1024 * 1024));
+
+            // Many of them to grow the tracking table
+            void* ptrs[40];
+            for (u32 i = 0; i < 40; ++i)
+                ptrs[i] = g_heap_alloc(heap, 1024 * 1024 + i * 4096);
+            for (u32 i = 0; i < 40; ++i)
+                g_heap_dealloc(heap, ptrs[(i * 7) % 40]);
+
+            g_heap_dealloc(heap, c);
+            g_heap_dealloc(heap, b);
+            g_heap_dealloc(heap, a);
+            g_heap_release(heap);
+        }
+
+        UNITTEST_TEST(realloc_null_is_huge)
+        {
+            heap_t* heap = g_heap_create(1024 * 1024, 16 * 1024 * 1024);
+            g_heap_set_huge_threshold(heap, 1024 * 1024);
+
+            // Larger than the reservation of the heap, only a huge allocation can serve it
+            u8* a = (u8*)g_heap_realloc(heap, nullptr, 32 * 1024 * 1024);
+            CHECK_NOT_NULL(a);
+            CHECK_NULL(heap->m_pools);
+            a[32 * 1024 * 1024 - 1] = 1;
+
+            g_heap_dealloc(heap, a);
+            g_heap_release(heap);
+        }
+
+        UNITTEST_TEST(huge_pages_for_huge_allocations)
+        {
+            heap_t* heap = g_heap_create(1024 * 1024, 16 * 1024 * 1024, true);
+
+            // Starts at a huge page and the whole last huge page is usable
+            u8* a = (u8*)g_heap_alloc(heap, 5 * 1024 * 1024);
+            CHECK_NOT_NULL(a);
+            CHECK_EQUAL((uint_t)0, (uint_t)a & (2 * 1024 * 1024 - 1));
+            CHECK_EQUAL((u32)6 * 1024 * 1024, g_heap_usable_size(heap, a));
+            a[6 * 1024 * 1024 - 1] = 1;
+
+            g_heap_dealloc(heap, a);
+            g_heap_release(heap);
+        }
+
+        UNITTEST_TEST(sized_dealloc_after_threshold_change)
+        {
+            heap_t* heap = g_heap_create(1024 * 1024, 16 * 1024 * 1024);
+            g_heap_set_huge_threshold(heap, 1024 * 1024);
+
+            // The first huge allocation creates the table that tracks them
+            g_heap_dealloc(heap, g_heap_alloc(heap, 2 * 1024 * 1024));
+
+            heap_report_t before;
+            g_heap_report(heap, &before);
+            void* a = g_heap_alloc(heap, 2 * 1024 * 1024);
+            CHECK_NOT_NULL(a);
+
+            // Once the threshold is raised the size no longer tells that 'a' is huge
+            g_heap_set_huge_threshold(heap, 8 * 1024 * 1024);
+            g_heap_dealloc_sized(heap, a, 2 * 1024 * 1024);
+
+            heap_report_t after;
+            g_heap_report(heap, &after);
+            CHECK_EQUAL(before.m_committed, after.m_committed);
+            g_heap_release(heap);
+        }
+    }
+
+    UNITTEST_FIXTURE(checkpoint)
+    {
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        static void s_allocate_many(heap_t* heap, void** ptrs, u32 count)
+        {
+            for (u32 i = 0; i < count; ++i)
+            {
+                const u32 size = (i & 7) == 7 ? 1024 * 1024 + 16 : 8 + ((i * 97) & 4095);
+                ptrs[i]        = g_heap_alloc(heap, size);
+                nmem::memset(ptrs[i], 0xEE, size);
+            }
+        }
+
+        UNITTEST_TEST(rollback_discards_everything)
+        {
+            heap_t* heap = g_heap_create(1024 * 1024, 16 * 1024 * 1024);
+            g_heap_set_huge_threshold(heap, 512 * 1024);
+
+            // Memory from before the checkpoint, with some free blocks in between
+            u8*   a = (u8*)g_heap_alloc(heap, 1000);
+            u8*   b = (u8*)g_heap_alloc(heap, 64);
+            void* c = g_heap_alloc(heap, 3000);
+            void* d = g_heap_alloc(heap, 200);
+            g_heap_dealloc(heap, c);
+            nmem::memset(a, 0xAA, 1000);
+
+            g_heap_checkpoint(heap);
+            void* first[64];
+            s_allocate_many(heap, first, 64);
+
+            // Freeing and growing memory from before the checkpoint leaves it untouched until the rollback
+            g_heap_dealloc(heap, b);
+            u8* r = (u8*)g_heap_realloc(heap, a, 2000);
+            CHECK_TRUE(r != a);
+            CHECK_EQUAL(0xAA, r[999]);
+            CHECK_EQUAL(0xAA, a[999]);
+            for (u32 i = 0; i < 64; i += 2)
+                g_heap_dealloc(heap, first[i]);
+            g_heap_rollback(heap);
+
+            // The same allocations after a second checkpoint end up at the same addresses
+            g_heap_checkpoint(heap);
+            void* second[64];
+            s_allocate_many(heap, second, 64);
+            for (u32 i = 0; i < 64; ++i)
+            {
+                if ((i & 7) != 7) // huge allocations get a new arena
+                    CHECK_EQUAL(first[i], second[i]);
+            }
+            g_heap_rollback(heap);
+
+            // 'a' and 'b' have been freed by the rollback, the heap is fully usable
+            void* e = g_heap_alloc(heap, 900);
+            CHECK_NOT_NULL(e);
+            g_heap_dealloc(heap, e);
+            g_heap_dealloc(heap, d);
+            g_heap_release(heap);
+        }
+    }
+
+    UNITTEST_FIXTURE(categories)
+    {
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(live_bytes_per_category)
+        {
+            heap_t* heap = g_heap_create(1024 * 1024, 16 * 1024 * 1024);
+            g_heap_set_huge_threshold(heap, 512 * 1024);
+
+            // A slab object, a block and a huge allocation in category 1, an aligned block in category 2
+            void* a = g_heap_alloc(heap, 40, 1);
+            void* b = g_heap_alloc(heap, 1000, 1);
+            void* c = g_heap_alloc(heap, 600 * 1024, 1);
+            void* d = g_heap_alloc_aligned(heap, 3000, 256, 2);
+            void* e = g_heap_alloc(heap, 500);
+            CHECK_NOT_NULL(a);
+            CHECK_NOT_NULL(b);
+            CHECK_NOT_NULL(c);
+            CHECK_NOT_NULL(d);
+            CHECK_NOT_NULL(e);
+
+            heap_category_t stats[4];
+#ifdef HEAP_CATEGORIES
+            CHECK_EQUAL(4, g_heap_categories(heap, stats, 4));
+            CHECK_EQUAL(1, (s32)stats[HEAP_CATEGORY_NONE].m_count);
+            CHECK_EQUAL((int_t)g_heap_usable_size(heap, e), stats[HEAP_CATEGORY_NONE].m_bytes);
+            CHECK_EQUAL(3, (s32)stats[1].m_count);
+            CHECK_EQUAL((int_t)(g_heap_usable_size(heap, a) + g_heap_usable_size(heap, b) + g_heap_usable_size(heap, c)), stats[1].m_bytes);
+            CHECK_EQUAL(1, (s32)stats[2].m_count);
+            CHECK_EQUAL((int_t)g_heap_usable_size(heap, d), stats[2].m_bytes);
+
+            // A reallocation keeps the category, also when the allocation moves
+            b = g_heap_realloc(heap, b, 8000);
+            a = g_heap_realloc(heap, a, 300);
+            g_heap_categories(heap, stats, 4);
+            CHECK_EQUAL(3, (s32)stats[1].m_count);
+            CHECK_EQUAL((int_t)(g_heap_usable_size(heap, a) + g_heap_usable_size(heap, b) + g_heap_usable_size(heap, c)), stats[1].m_bytes);
+
+            g_heap_dealloc(heap, a);
+            g_heap_dealloc(heap, b);
+            g_heap_dealloc(heap, c);
+            g_heap_dealloc(heap, d);
+            g_heap_dealloc(heap, e);
+            g_heap_categories(heap, stats, 4);
+            for (u32 i = 0; i < 4; ++i)
+            {
+                CHECK_EQUAL(0, (s32)stats[i].m_count);
+                CHECK_EQUAL(0, (s32)stats[i].m_bytes);
+            }
+#else
+            CHECK_EQUAL(0, g_heap_categories(heap, stats, 4));
+            g_heap_dealloc(heap, a);
+            g_heap_dealloc(heap, b);
+            g_heap_dealloc(heap, c);
+            g_heap_dealloc(heap, d);
+            g_heap_dealloc(heap, e);
+#endif
+            g_heap_release(heap);
+        }
+    }
+
+    UNITTEST_FIXTURE(report)
+    {
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(free_blocks_per_bin)
+        {
+            heap_t* heap = g_heap_create(1024 * 1024, 16 * 1024 * 1024);
+
+            // Free every other block so that the free blocks cannot coalesce
+            void* ptrs[32];
+            for (u32 i = 0; i < 32; ++i)
+                ptrs[i] = g_heap_alloc(heap, 1000 + i * 512);
+            for (u32 i = 0; i < 32; i += 2)
+                g_heap_dealloc(heap, ptrs[i]);
+
+            heap_report_t* report = g_allocate<heap_report_t>(heap);
+            g_heap_report(heap, report);
+
+            u32 blocks = 0;
+            for (u32 fl = 0; fl < heap_report_t::FL_BINS; ++fl)
+                for (u32 sl = 0; sl < heap_report_t::SL_BINS; ++sl)
+                    blocks += report->m_bins[fl][sl];
+
+            CHECK_EQUAL(report->m_free_blocks, blocks);
+            CHECK_TRUE(report->m_free_blocks >= 16); // plus the remainder at the tail
+            CHECK_TRUE(report->m_largest_free >= 1000 + 30 * 512);
+            CHECK_TRUE(report->m_largest_free <= report->m_free_bytes);
+            CHECK_TRUE(report->m_committed > 0);
+            CHECK_TRUE(report->m_committed <= report->m_reserved);
+            CHECK_EQUAL(16 * 1024 * 1024, (s32)report->m_reserved);
+
+            // After releasing everything only the report itself is in use
+            for (u32 i = 1; i < 32; i += 2)
+                g_heap_dealloc(heap, ptrs[i]);
+            g_heap_report(heap, report);
+            CHECK_TRUE(report->m_free_blocks <= 2);
+
+            g_deallocate(heap, report);
+            g_heap_release(heap);
+        }
+
+        UNITTEST_TEST(committed_in_huge_pages)
+        {
+            heap_t* heap = g_heap_create(1024 * 1024, 16 * 1024 * 1024, true);
+
+            // The region of a heap with huge pages is committed in 2 MB units
+            void*          ptr    = g_heap_alloc(heap, 1000);
+            heap_report_t* report = g_allocate<heap_report_t>(heap);
+            g_heap_report(heap, report);
+            CHECK_EQUAL((int_t)2 * 1024 * 1024, report->m_committed);
+
+            g_deallocate(heap, report);
+            g_heap_dealloc(heap, ptr);
+            g_heap_release(heap);
+        }
+    }
+
+    UNITTEST_FIXTURE(best_fit)
+    {
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(takes_the_closest_block_of_the_bin)
+        {
+            heap_t* heap = g_heap_create(1024 * 1024, 16 * 1024 * 1024);
+            g_heap_set_best_fit(heap, 8);
+
+            // Two free blocks in the same bin, kept apart by used blocks
+            void* x = g_heap_alloc(heap, 1080);
+            void* a = g_heap_alloc(heap, 256);
+            void* y = g_heap_alloc(heap, 1032);
+            void* b = g_heap_alloc(heap, 256);
+            g_heap_dealloc(heap, x);
+            g_heap_dealloc(heap, y);
+
+            // Good-fit would skip this bin, best-fit takes the block that fits exactly
+            void* c = g_heap_alloc(heap, 1030);
+            CHECK_EQUAL(y, c);
+            void* d = g_heap_alloc(heap, 1050);
+            CHECK_EQUAL(x, d);
+
+            g_heap_dealloc(heap, a);
+            g_heap_dealloc(heap, b);
+            g_heap_dealloc(heap, c);
+            g_heap_dealloc(heap, d);
+            g_heap_release(heap);
+        }
+    }
+
+    UNITTEST_FIXTURE(handles)
+    {
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(compaction_releases_the_tail)
+        {
+            heap_t* heap = g_heap_create(1024 * 1024, 64 * 1024 * 1024);
+
+            const u32     count = 256;
+            heap_handle_t handles[count];
+            for (u32 i = 0; i < count; ++i)
+            {
+                const u32 size = 512 + (i * 331) % 8192;
+                handles[i]     = g_heap_handle_alloc(heap, size);
+                CHECK_NOT_EQUAL(0, handles[i]);
+                nmem::memset(g_heap_handle_get(heap, handles[i]), (s32)(i & 0xFF), size);
+            }
+
+            // Fragment, free 3 out of every 4 allocations
+            for (u32 i = 0; i < count; ++i)
+            {
+                if ((i & 3) != 0)
+                {
+                    g_heap_handle_free(heap, handles[i]);
+                    handles[i] = 0;
+                }
+            }
+
+            heap_report_t* report = g_allocate<heap_report_t>(heap);
+            g_heap_report(heap, report);
+            const int_t committed_before = report->m_committed;
+            g_deallocate(heap, report);
+
+            // Small budgets, many calls
+            s32 calls = 0;
+            while (!g_heap_compact(heap, 16 * 1024))
+                ++calls;
+            CHECK_TRUE(calls > 1);
+
+            // The data moved with the allocations and the tail has been given back
+            for (u32 i = 0; i < count; i += 4)
+            {
+                const u8* p    = (const u8*)g_heap_handle_get(heap, handles[i]);
+                const u32 size = 512 + (i * 331) % 8192;
+                CHECK_EQUAL((u8)(i & 0xFF), p[0]);
+                CHECK_EQUAL((u8)(i & 0xFF), p[size - 1]);
+            }
+            report = g_allocate<heap_report_t>(heap);
+            g_heap_report(heap, report);
+            CHECK_TRUE(report->m_committed < committed_before);
+            g_deallocate(heap, report);
+
+            for (u32 i = 0; i < count; i += 4)
+                g_heap_handle_free(heap, handles[i]);
+            g_heap_release(heap);
+        }
+    }
+
+    UNITTEST_FIXTURE(remote_free)
+    {
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        static void s_release_all(heap_t* heap, void** ptrs, s32 count)
+        {
+            for (s32 i = 0; i < count; ++i)
+                g_heap_dealloc(heap, ptrs[i]);
+        }
+
+        UNITTEST_TEST(dealloc_from_other_thread)
+        {
+            heap_t* heap = g_heap_create(1024 * 1024, 16 * 1024 * 1024);
+
+            void* ptrs[512];
+            for (s32 i = 0; i < 512; ++i)
+                ptrs[i] = g_heap_alloc(heap, 32 + (i & 15) * 8);
+            void* const first = ptrs[0];
+
+            // The consumer thread releases everything, the blocks end up on the remote free list
+            std::thread consumer(s_release_all, heap, ptrs, 512);
+            consumer.join();
+            CHECK_NOT_NULL(heap->m_remote_free);
+
+            // The next allocation by the owner merges all of them back into the heap
+            void* ptr = g_heap_alloc(heap, 32);
+            CHECK_NULL(heap->m_remote_free);
+            CHECK_EQUAL(first, ptr);
+            g_heap_dealloc(heap, ptr);
+
+            g_heap_release(heap);
+        }
     }
 }
 UNITTEST_SUITE_END
@@ -0,0 +1,10 @@
+// The heap suite with allocation categories (HEAP_CATEGORIES, 64-bit only). The heap is compiled into
+// this file with the define, its symbols are those of its own variant (see c_allocator_heap.h) so it
+// does not clash with the heap of the library.
+#include "ccore/c_target.h"
+#if CC_PLATFORM_PTR_SIZE == 8
+#    define HEAP_CATEGORIES
+#    define HEAP_TEST_SUITE heap_categories
+#    include "../../main/cpp/c_allocator_heap.cpp"
+#    include "test_allocator_heap.cpp"
+#endif
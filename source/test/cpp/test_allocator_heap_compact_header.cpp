@@ -0,0 +1,7 @@
+// The heap suite with compact block headers (TLSF_COMPACT_HEADER, 64-bit only, the same as the default
+// heap otherwise). The heap is compiled into this file with the define, its symbols are those of its
+// own variant (see c_allocator_heap.h) so it does not clash with the heap of the library.
+#define TLSF_COMPACT_HEADER
+#define HEAP_TEST_SUITE heap_compact_header
+#include "../../main/cpp/c_allocator_heap.cpp"
+#include "test_allocator_heap.cpp"
@@ -2,6 +2,9 @@
 #include "callocator/c_allocator_offset.h"
 #include "cunittest/cunittest.h"
 
+#include <atomic>
+#include <thread>
+
 using namespace ncore;
 
 namespace ncore
@@ -15,6 +18,9 @@ namespace ncore
             extern u32 U32ToF32RoundUp(u32 size);
             extern u32 U32ToF32RoundDown(u32 size);
             extern u32 F32ToU32(u32 floatValue);
+            extern u32 U64ToF32RoundUp(u64 size);
+            extern u32 U64ToF32RoundDown(u64 size);
+            extern u64 F32ToU64(u32 floatValue);
         } // namespace nfloat
     } // namespace noffset
 } // namespace ncore
@@ -319,5 +325,842 @@ UNITTEST_SUITE_BEGIN(offset)
             allocator->free(validateAll);
         }
     }
+
+    UNITTEST_FIXTURE(aligned)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(padding_goes_back_to_the_bins)
+        {
+            ncore::noffset::allocator_t alloc(Allocator, 1024 * 1024 * 16);
+            alloc.setup();
+
+            ncore::noffset::allocation_t a = alloc.allocate(100);
+            CHECK_EQUAL((u32)0, a.offset);
+
+            // Aligned start, the exact size is kept and the padding [100, 256) is free
+            ncore::noffset::allocation_t b = alloc.allocate(1000, 256);
+            CHECK_EQUAL((u32)256, b.offset);
+            CHECK_EQUAL((u32)1000, alloc.allocationSize(b));
+
+            ncore::noffset::allocation_t c = alloc.allocate(64 * 1024, 64 * 1024);
+            CHECK_EQUAL((u32)64 * 1024, c.offset);
+
+            // The padding is reused by a small allocation
+            ncore::noffset::allocation_t d = alloc.allocate(128);
+            CHECK_EQUAL((u32)100, d.offset);
+
+            ncore::noffset::storage_report_t report = alloc.storageReport();
+            CHECK_EQUAL((u32)1024 * 1024 * 16 - 100 - 1000 - 64 * 1024 - 128, report.totalFreeSpace);
+
+            alloc.free(a);
+            alloc.free(c);
+            alloc.free(d);
+            alloc.free(b);
+
+            // End: Validate that allocator has no fragmentation left. Should be 100% clean.
+            ncore::noffset::allocation_t validateAll = alloc.allocate(1024 * 1024 * 16);
+            CHECK_EQUAL((u32)0, validateAll.offset);
+            alloc.free(validateAll);
+
+            alloc.teardown();
+        }
+
+        UNITTEST_TEST(mixed_alignments)
+        {
+            ncore::noffset::allocator_t alloc(Allocator, 1024 * 1024 * 16);
+            alloc.setup();
+
+            const u32                    alignments[] = {1, 4, 16, 256, 4096, 64 * 1024};
+            ncore::noffset::allocation_t allocations[96];
+            for (u32 i = 0; i < 96; i++)
+            {
+                const u32 alignment = alignments[i % 6];
+                allocations[i]      = alloc.allocate(13 + i * 97, alignment);
+                CHECK_NOT_EQUAL(ncore::noffset::allocation_t::NO_SPACE, allocations[i].offset);
+                CHECK_EQUAL((u32)0, allocations[i].offset & (alignment - 1));
+            }
+            for (u32 i = 0; i < 96; i += 2)
+                alloc.free(allocations[i]);
+            for (u32 i = 1; i < 96; i += 2)
+                alloc.free(allocations[i]);
+
+            ncore::noffset::storage_report_t report = alloc.storageReport();
+            CHECK_EQUAL((u32)1024 * 1024 * 16, report.totalFreeSpace);
+            CHECK_EQUAL((u32)1024 * 1024 * 16, report.largestFreeRegion);
+
+            alloc.teardown();
+        }
+    }
+
+    UNITTEST_FIXTURE(growable)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(nodes_grow)
+        {
+            // Starts with 32 nodes, ends up with thousands of live allocations
+            ncore::noffset::allocator_t alloc(Allocator, 1024 * 1024 * 16, 0, 32);
+            alloc.setup();
+
+            const u32                     count       = 5000;
+            ncore::noffset::allocation_t* allocations = g_allocate_array<ncore::noffset::allocation_t>(Allocator, count);
+            for (u32 i = 0; i < count; i++)
+            {
+                allocations[i] = alloc.allocate(100 + (i & 7));
+                CHECK_NOT_EQUAL(ncore::noffset::allocation_t::NO_SPACE, allocations[i].offset);
+            }
+
+            // Metadata taken before the growth is still valid
+            for (u32 i = 0; i < count; i++)
+                CHECK_EQUAL(100 + (i & 7), alloc.allocationSize(allocations[i]));
+            for (u32 i = 0; i < count; i += 2)
+                alloc.free(allocations[i]);
+            for (u32 i = 1; i < count; i += 2)
+                alloc.free(allocations[i]);
+
+            // End: Validate that allocator has no fragmentation left. Should be 100% clean.
+            ncore::noffset::allocation_t validateAll = alloc.allocate(1024 * 1024 * 16);
+            CHECK_EQUAL((u32)0, validateAll.offset);
+            alloc.free(validateAll);
+
+            Allocator->deallocate(allocations);
+            alloc.teardown();
+        }
+
+        UNITTEST_TEST(node_limit)
+        {
+            const u32                   size = 1024 * 1024 + 63 * 16;
+            ncore::noffset::allocator_t alloc(Allocator, size, 64, 32);
+            alloc.setup();
+
+            // Every allocation leaves a remainder node, the limit is hit before the storage is used up
+            ncore::noffset::allocation_t allocations[64];
+            u32                          count = 0;
+            while (count < 64)
+            {
+                allocations[count] = alloc.allocate(16);
+                if (allocations[count].offset == ncore::noffset::allocation_t::NO_SPACE)
+                    break;
+                count++;
+            }
+            CHECK_EQUAL((u32)63, count);
+
+            // The last node is the remainder, an exact fit needs no new node and takes it
+            allocations[count] = alloc.allocate(1024 * 1024);
+            CHECK_EQUAL((u32)63 * 16, allocations[count].offset);
+            count++;
+            CHECK_EQUAL((u32)0, alloc.storageReport().totalFreeSpace);
+
+            for (u32 i = 0; i < count; i++)
+                alloc.free(allocations[i]);
+            CHECK_EQUAL(size, alloc.storageReport().totalFreeSpace);
+
+            alloc.teardown();
+        }
+
+        UNITTEST_TEST(node_limit_rounds_up)
+        {
+            // A limit of 5 nodes becomes 32 (one m_nodeUsed word), same as a limit of 32
+            const u32                   size = 1024 * 1024 + 31 * 16;
+            ncore::noffset::allocator_t alloc(Allocator, size, 5, 1);
+            alloc.setup();
+            CHECK_EQUAL(size, alloc.storageReport().totalFreeSpace);
+
+            ncore::noffset::allocation_t allocations[32];
+            u32                          count = 0;
+            while (count < 32)
+            {
+                allocations[count] = alloc.allocate(16);
+                if (allocations[count].offset == ncore::noffset::allocation_t::NO_SPACE)
+                    break;
+                count++;
+            }
+            CHECK_EQUAL((u32)31, count);
+
+            allocations[count] = alloc.allocate(1024 * 1024);
+            CHECK_EQUAL((u32)31 * 16, allocations[count].offset);
+            count++;
+
+            for (u32 i = 0; i < count; i++)
+                alloc.free(allocations[i]);
+            CHECK_EQUAL(size, alloc.storageReport().totalFreeSpace);
+
+            alloc.teardown();
+        }
+    }
+
+    UNITTEST_FIXTURE(deferred)
+    {
+        UNITTEST_ALLOCATOR;
+
+        // Fails every allocation while 'm_fail' is set
+        class failing_alloc_t : public alloc_t
+        {
+        public:
+            failing_alloc_t(alloc_t* allocator) : m_allocator(allocator), m_fail(false) {}
+
+            alloc_t* m_allocator;
+            bool     m_fail;
+
+        protected:
+            virtual void* v_allocate(u32 size, u32 alignment) { return m_fail ? nullptr : m_allocator->allocate(size, alignment); }
+            virtual void  v_deallocate(void* ptr) { m_allocator->deallocate(ptr); }
+        };
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(retire_by_fence)
+        {
+            ncore::noffset::allocator_t alloc(Allocator, 1024 * 1024);
+            alloc.setup();
+
+            // Three frames, each frees one of its allocations at the end
+            ncore::noffset::allocation_t a = alloc.allocate(1000);
+            ncore::noffset::allocation_t b = alloc.allocate(2000);
+            ncore::noffset::allocation_t c = alloc.allocate(3000);
+            alloc.free(a, 1);
+            alloc.free(b, 2);
+            alloc.free(c, 3);
+            CHECK_EQUAL((u32)3, alloc.pendingFrees());
+
+            // Still in use until the fence completes
+            CHECK_EQUAL((u32)0, alloc.retire(0));
+            CHECK_EQUAL((u32)1024 * 1024 - 6000, alloc.storageReport().totalFreeSpace);
+            ncore::noffset::allocation_t d = alloc.allocate(100);
+            CHECK_EQUAL((u32)6000, d.offset);
+
+            CHECK_EQUAL((u32)2, alloc.retire(2));
+            CHECK_EQUAL((u32)1, alloc.pendingFrees());
+            CHECK_EQUAL((u32)1024 * 1024 - 3100, alloc.storageReport().totalFreeSpace);
+
+            CHECK_EQUAL((u32)1, alloc.retire(10));
+            CHECK_EQUAL((u32)0, alloc.pendingFrees());
+            alloc.free(d);
+
+            // End: Validate that allocator has no fragmentation left. Should be 100% clean.
+            ncore::noffset::allocation_t validateAll = alloc.allocate(1024 * 1024);
+            CHECK_EQUAL((u32)0, validateAll.offset);
+            alloc.free(validateAll);
+
+            alloc.teardown();
+        }
+
+        UNITTEST_TEST(queue_cannot_grow)
+        {
+            failing_alloc_t             failing(Allocator);
+            ncore::noffset::allocator_t alloc(&failing, 1024 * 1024);
+            alloc.setup();
+
+            // The queue has no storage yet and cannot get any, the allocation stays in use
+            ncore::noffset::allocation_t a = alloc.allocate(1000);
+            failing.m_fail                 = true;
+            CHECK_FALSE(alloc.free(a, 1));
+            CHECK_EQUAL((u32)0, alloc.pendingFrees());
+            CHECK_EQUAL((u32)1024 * 1024 - 1000, alloc.storageReport().totalFreeSpace);
+
+            failing.m_fail = false;
+            CHECK_TRUE(alloc.free(a, 1));
+            CHECK_EQUAL((u32)1, alloc.retire(1));
+            CHECK_EQUAL((u32)1024 * 1024, alloc.storageReport().totalFreeSpace);
+
+            alloc.teardown();
+        }
+
+        UNITTEST_TEST(ring_frames)
+        {
+            ncore::noffset::allocator_t alloc(Allocator, 1024 * 1024 * 16);
+            alloc.setup();
+
+            // Every frame allocates 100 buffers and frees them with its frame number, the GPU is 3 frames behind
+            ncore::noffset::allocation_t allocations[100];
+            for (u64 frame = 1; frame <= 50; ++frame)
+            {
+                if (frame > 3)
+                    CHECK_EQUAL((u32)100, alloc.retire(frame - 3));
+                for (u32 i = 0; i < 100; ++i)
+                {
+                    allocations[i] = alloc.allocate(256 + i * 8, 256);
+                    CHECK_NOT_EQUAL(ncore::noffset::allocation_t::NO_SPACE, allocations[i].offset);
+                }
+                for (u32 i = 0; i < 100; ++i)
+                    alloc.free(allocations[i], frame);
+            }
+            CHECK_EQUAL((u32)300, alloc.pendingFrees());
+            CHECK_EQUAL((u32)300, alloc.retire(50));
+
+            ncore::noffset::storage_report_t report = alloc.storageReport();
+            CHECK_EQUAL((u32)1024 * 1024 * 16, report.totalFreeSpace);
+            CHECK_EQUAL((u32)1024 * 1024 * 16, report.largestFreeRegion);
+
+            alloc.teardown();
+        }
+    }
+
+    UNITTEST_FIXTURE(defrag)
+    {
+        UNITTEST_ALLOCATOR;
+
+        static u32 s_free_regions(ncore::noffset::allocator_t const& alloc)
+        {
+            ncore::noffset::full_storage_report_t report = alloc.storageReportFull();
+            u32                                   count  = 0;
+            for (u32 i = 0; i < ncore::noffset::NUM_LEAF_BINS; i++)
+                count += report.freeRegions[i].count;
+            return count;
+        }
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(pack_towards_zero)
+        {
+            ncore::noffset::allocator_t alloc(Allocator, 1024 * 1024);
+            alloc.setup();
+
+            // Free every other allocation, leaving 16 holes
+            ncore::noffset::allocation_t allocations[32];
+            for (u32 i = 0; i < 32; i++)
+                allocations[i] = alloc.allocate(1024);
+            for (u32 i = 0; i < 32; i += 2)
+                alloc.free(allocations[i]);
+            CHECK_EQUAL((u32)17, s_free_regions(alloc));
+
+            ncore::noffset::defrag_move_t moves[32];
+            const u32                     count = alloc.planDefrag(moves, 32, 1024 * 1024);
+            CHECK_EQUAL((u32)16, count);
+            for (u32 i = 0; i < count; i++)
+            {
+                CHECK_EQUAL(allocations[i * 2 + 1].metadata, moves[i].metadata);
+                CHECK_EQUAL(allocations[i * 2 + 1].offset, moves[i].from);
+                CHECK_EQUAL(i * 1024, moves[i].to);
+            }
+            alloc.commitDefrag(moves, count);
+
+            // All free space is one region behind the packed allocations
+            CHECK_EQUAL((u32)1024 * 1024 - 16 * 1024, alloc.storageReport().totalFreeSpace);
+            CHECK_EQUAL((u32)1, s_free_regions(alloc));
+
+            // The moved allocations are freed through their (unchanged) metadata
+            for (u32 i = 1; i < 32; i += 2)
+                alloc.free(allocations[i]);
+
+            // End: Validate that allocator has no fragmentation left. Should be 100% clean.
+            ncore::noffset::allocation_t validateAll = alloc.allocate(1024 * 1024);
+            CHECK_EQUAL((u32)0, validateAll.offset);
+            alloc.free(validateAll);
+
+            alloc.teardown();
+        }
+
+        UNITTEST_TEST(random_rounds)
+        {
+            ncore::noffset::allocator_t alloc(Allocator, 1024 * 1024 * 4, 0, 64);
+            alloc.setup();
+
+            // Random allocations and frees, a defrag with a small budget after every round
+            ncore::noffset::allocation_t  allocations[256];
+            u32                           alignments[256];
+            ncore::noffset::defrag_move_t moves[16];
+            u32                           live = 0;
+            u32                           used = 0;
+            u32                           rnd  = 0x9E3779B9;
+            for (u32 round = 0; round < 200; round++)
+            {
+                for (u32 n = 0; n < 32; n++)
+                {
+                    rnd ^= rnd << 13;
+                    rnd ^= rnd >> 17;
+                    rnd ^= rnd << 5;
+                    if (live < 256 && ((rnd & 1) || live == 0))
+                    {
+                        alignments[live]  = (u32)1 << ((rnd >> 16) & 7);
+                        allocations[live] = alloc.allocate(16 + ((rnd >> 4) & 4095), alignments[live]);
+                        CHECK_NOT_EQUAL(ncore::noffset::allocation_t::NO_SPACE, allocations[live].offset);
+                        used += alloc.allocationSize(allocations[live]);
+                        live++;
+                    }
+                    else
+                    {
+                        const u32 i = (rnd >> 8) % live;
+                        used -= alloc.allocationSize(allocations[i]);
+                        alloc.free(allocations[i]);
+                        allocations[i] = allocations[--live];
+                        alignments[i]  = alignments[live];
+                    }
+                }
+
+                // Capped at the largest alignment that is used, every other round without a cap
+                const u32 count = alloc.planDefrag(moves, 16, 16 * 1024, (round & 1) ? 128 : 0);
+                alloc.commitDefrag(moves, count);
+                for (u32 m = 0; m < count; m++)
+                {
+                    CHECK_TRUE(moves[m].to < moves[m].from);
+                    for (u32 i = 0; i < live; i++)
+                    {
+                        if (allocations[i].metadata == moves[m].metadata)
+                            allocations[i].offset = moves[m].to;
+                    }
+                }
+                for (u32 i = 0; i < live; i++)
+                    CHECK_EQUAL((u32)0, allocations[i].offset & (alignments[i] - 1));
+                CHECK_EQUAL((u32)1024 * 1024 * 4 - used, alloc.storageReport().totalFreeSpace);
+            }
+
+            for (u32 i = 0; i < live; i++)
+                alloc.free(allocations[i]);
+            CHECK_EQUAL((u32)1, s_free_regions(alloc));
+            CHECK_EQUAL((u32)1024 * 1024 * 4, alloc.storageReport().totalFreeSpace);
+
+            alloc.teardown();
+        }
+
+        UNITTEST_TEST(budget_and_alignment)
+        {
+            ncore::noffset::allocator_t alloc(Allocator, 1024 * 1024);
+            alloc.setup();
+
+            ncore::noffset::allocation_t a = alloc.allocate(100);
+            ncore::noffset::allocation_t b = alloc.allocate(1000, 256);
+            ncore::noffset::allocation_t c = alloc.allocate(3000);
+            ncore::noffset::allocation_t d = alloc.allocate(500);
+            alloc.free(a);
+            alloc.free(c);
+
+            // Budget for 'b' only, it keeps its 256 byte alignment
+            ncore::noffset::defrag_move_t moves[4];
+            u32                           count = alloc.planDefrag(moves, 4, 1200, 256);
+            CHECK_EQUAL((u32)1, count);
+            CHECK_EQUAL((u32)0, moves[0].to);
+            alloc.commitDefrag(moves, count);
+            CHECK_EQUAL((u32)1000, alloc.allocationSize(b));
+
+            // Then 'd' behind 'b', its offset (4256) is aligned to 32 so it goes to 1024
+            count = alloc.planDefrag(moves, 4, 1024 * 1024, 256);
+            CHECK_EQUAL((u32)1, count);
+            CHECK_EQUAL(d.offset, moves[0].from);
+            CHECK_EQUAL((u32)1024, moves[0].to);
+            alloc.commitDefrag(moves, count);
+
+            ncore::noffset::storage_report_t report = alloc.storageReport();
+            CHECK_EQUAL((u32)1024 * 1024 - 1500, report.totalFreeSpace);
+
+            alloc.free(b);
+            alloc.free(d);
+            ncore::noffset::allocation_t validateAll = alloc.allocate(1024 * 1024);
+            CHECK_EQUAL((u32)0, validateAll.offset);
+            alloc.free(validateAll);
+
+            alloc.teardown();
+        }
+
+        UNITTEST_TEST(default_keeps_alignment)
+        {
+            ncore::noffset::allocator_t alloc(Allocator, 1024 * 1024);
+            alloc.setup();
+
+            ncore::noffset::allocation_t a = alloc.allocate(8);
+            ncore::noffset::allocation_t b = alloc.allocate(8);
+            ncore::noffset::allocation_t c = alloc.allocate(100, 256);
+            CHECK_EQUAL((u32)256, c.offset);
+            alloc.free(b);
+
+            // Without a cap 'c' keeps its 256 byte alignment, there is no better place for it
+            ncore::noffset::defrag_move_t moves[4];
+            CHECK_EQUAL((u32)0, alloc.planDefrag(moves, 4, 1024 * 1024));
+
+            alloc.free(a);
+            const u32 count = alloc.planDefrag(moves, 4, 1024 * 1024);
+            CHECK_EQUAL((u32)1, count);
+            CHECK_EQUAL((u32)0, moves[0].to);
+            alloc.commitDefrag(moves, count);
+
+            alloc.free(c);
+            ncore::noffset::allocation_t validateAll = alloc.allocate(1024 * 1024);
+            CHECK_EQUAL((u32)0, validateAll.offset);
+            alloc.free(validateAll);
+
+            alloc.teardown();
+        }
+
+        UNITTEST_TEST(pending_is_a_barrier)
+        {
+            ncore::noffset::allocator_t alloc(Allocator, 1024 * 1024);
+            alloc.setup();
+
+            ncore::noffset::allocation_t x = alloc.allocate(1000);
+            ncore::noffset::allocation_t y = alloc.allocate(1000);
+            ncore::noffset::allocation_t z = alloc.allocate(1000);
+            ncore::noffset::allocation_t w = alloc.allocate(1000);
+            alloc.free(x);
+            alloc.free(y, 5);
+            alloc.free(z);
+
+            // 'y' is not moved and 'w' only slides down to the end of 'y'
+            ncore::noffset::defrag_move_t moves[4];
+            const u32                     count = alloc.planDefrag(moves, 4, 1024 * 1024);
+            CHECK_EQUAL((u32)1, count);
+            CHECK_EQUAL(w.metadata, moves[0].metadata);
+            CHECK_EQUAL((u32)2000, moves[0].to);
+            alloc.commitDefrag(moves, count);
+
+            // The range of 'y' is still taken until its fence completes
+            ncore::noffset::allocation_t a = alloc.allocate(1500);
+            CHECK_TRUE(a.offset >= 3000);
+            alloc.free(a);
+
+            CHECK_EQUAL((u32)1, alloc.retire(5));
+            alloc.free(w);
+            ncore::noffset::allocation_t validateAll = alloc.allocate(1024 * 1024);
+            CHECK_EQUAL((u32)0, validateAll.offset);
+            alloc.free(validateAll);
+
+            alloc.teardown();
+        }
+    }
+
+    UNITTEST_FIXTURE(persist)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(save_and_load)
+        {
+            ncore::noffset::allocator_t alloc(Allocator, 1024 * 1024 * 4, 0, 64);
+            alloc.setup();
+
+            // Enough allocations to grow the nodes, every third one is freed and a few are still pending
+            ncore::noffset::allocation_t allocations[300];
+            for (u32 i = 0; i < 300; i++)
+                allocations[i] = alloc.allocate(100 + i * 7, (i & 1) ? 64 : 1);
+            for (u32 i = 0; i < 300; i += 3)
+                alloc.free(allocations[i]);
+            alloc.free(allocations[1], 10);
+            alloc.free(allocations[4], 11);
+
+            const u64 size = alloc.saveSize();
+            void*     blob = Allocator->allocate((u32)size);
+            CHECK_EQUAL((u64)0, alloc.save(blob, size - 1));
+            CHECK_EQUAL(size, alloc.save(blob, size));
+
+            // Restored instead of setup(), the allocations are the same as before
+            ncore::noffset::allocator_t restored(Allocator, 1024 * 1024 * 4, 0, 64);
+            CHECK_TRUE(restored.load(blob, size));
+            CHECK_EQUAL((u32)2, restored.pendingFrees());
+            CHECK_EQUAL(alloc.storageReport().totalFreeSpace, restored.storageReport().totalFreeSpace);
+            CHECK_EQUAL(alloc.storageReport().largestFreeRegion, restored.storageReport().largestFreeRegion);
+            for (u32 i = 0; i < 300; i++)
+            {
+                if ((i % 3) != 0)
+                    CHECK_EQUAL(alloc.allocationSize(allocations[i]), restored.allocationSize(allocations[i]));
+            }
+
+            // Both continue the same way
+            ncore::noffset::allocation_t a = alloc.allocate(5000, 256);
+            ncore::noffset::allocation_t b = restored.allocate(5000, 256);
+            CHECK_EQUAL(a.offset, b.offset);
+            CHECK_EQUAL(a.metadata, b.metadata);
+            alloc.free(a);
+            restored.free(b);
+
+            // Size mismatch
+            ncore::noffset::allocator_t other(Allocator, 1024 * 1024 * 2);
+            CHECK_FALSE(other.load(blob, size));
+            Allocator->deallocate(blob);
+
+            for (u32 i = 0; i < 300; i++)
+            {
+                if ((i % 3) != 0 && i != 1 && i != 4)
+                    restored.free(allocations[i]);
+            }
+            CHECK_EQUAL((u32)2, restored.retire(11));
+
+            ncore::noffset::allocation_t validateAll = restored.allocate(1024 * 1024 * 4);
+            CHECK_EQUAL((u32)0, validateAll.offset);
+            restored.free(validateAll);
+
+            restored.teardown();
+            alloc.teardown();
+        }
+    }
+
+    UNITTEST_FIXTURE(wide)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(float_64)
+        {
+            // Same bins as the 32-bit conversion for 32-bit values
+            for (u32 i = 0; i < 240; i++)
+            {
+                const u64 v = ncore::noffset::nfloat::F32ToU64(i);
+                CHECK_EQUAL((u64)ncore::noffset::nfloat::F32ToU32(i), v);
+                CHECK_EQUAL(i, ncore::noffset::nfloat::U64ToF32RoundUp(v));
+                CHECK_EQUAL(i, ncore::noffset::nfloat::U64ToF32RoundDown(v));
+            }
+
+            // Precise beyond 32-bit, up to the last bin below 2^64
+            for (u32 i = 240; i < 496; i++)
+            {
+                const u64 v = ncore::noffset::nfloat::F32ToU64(i);
+                CHECK_EQUAL(i, ncore::noffset::nfloat::U64ToF32RoundUp(v));
+                CHECK_EQUAL(i, ncore::noffset::nfloat::U64ToF32RoundDown(v));
+            }
+        }
+
+        UNITTEST_TEST(allocate_beyond_4gb)
+        {
+            const u64                     GB = (u64)1024 * 1024 * 1024;
+            ncore::noffset::allocator64_t alloc(Allocator, 64 * GB, 1024);
+            alloc.setup();
+
+            ncore::noffset::allocation64_t a = alloc.allocate(20 * GB);
+            ncore::noffset::allocation64_t b = alloc.allocate(20 * GB);
+            ncore::noffset::allocation64_t c = alloc.allocate(1000, 64 * 1024);
+            CHECK_EQUAL((u64)0, a.offset);
+            CHECK_EQUAL(20 * GB, b.offset);
+            CHECK_EQUAL(40 * GB, c.offset);
+            CHECK_EQUAL(20 * GB, alloc.allocationSize(b));
+
+            ncore::noffset::storage_report64_t report = alloc.storageReport();
+            CHECK_EQUAL(64 * GB - 40 * GB - 1000, report.totalFreeSpace);
+
+            ncore::noffset::allocation64_t none = alloc.allocate(30 * GB);
+            CHECK_EQUAL(ncore::noffset::allocation64_t::NO_SPACE, none.offset);
+
+            alloc.free(b);
+            alloc.free(a);
+            alloc.free(c);
+
+            // End: Validate that allocator has no fragmentation left. Should be 100% clean.
+            ncore::noffset::allocation64_t validateAll = alloc.allocate(64 * GB);
+            CHECK_EQUAL((u64)0, validateAll.offset);
+            alloc.free(validateAll);
+
+            alloc.teardown();
+        }
+    }
+
+    UNITTEST_FIXTURE(node_memory)
+    {
+        UNITTEST_ALLOCATOR;
+
+        // Counts the bytes that an allocator allocates for its bookkeeping
+        class counting_alloc_t : public alloc_t
+        {
+        public:
+            counting_alloc_t(alloc_t* allocator) : m_allocator(allocator), m_bytes(0) {}
+
+            alloc_t* m_allocator;
+            u64      m_bytes;
+
+        protected:
+            virtual void* v_allocate(u32 size, u32 alignment)
+            {
+                m_bytes += size;
+                return m_allocator->allocate(size, alignment);
+            }
+            virtual void v_deallocate(void* ptr) { m_allocator->deallocate(ptr); }
+        };
+
+        // Bookkeeping bytes for 64K nodes
+        template <typename A, typename T> static u64 s_node_memory(alloc_t* allocator, T size)
+        {
+            const u32        maxAllocs = 64 * 1024;
+            counting_alloc_t counter(allocator);
+            A                alloc(&counter, size, maxAllocs, maxAllocs);
+            alloc.setup();
+            alloc.teardown();
+            return counter.m_bytes;
+        }
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        // Memory per node of the 32-bit and 64-bit offset allocators in both node layouts
+        UNITTEST_TEST(layouts)
+        {
+            const u64 split32   = s_node_memory<ncore::noffset::allocator_t>(Allocator, (u32)1024 * 1024 * 1024);
+            const u64 compact32 = s_node_memory<ncore::noffset::allocator_compact_t>(Allocator, (u32)1024 * 1024 * 1024);
+            const u64 split64   = s_node_memory<ncore::noffset::allocator64_t>(Allocator, (u64)64 * 1024 * 1024 * 1024);
+            const u64 compact64 = s_node_memory<ncore::noffset::allocator64_compact_t>(Allocator, (u64)64 * 1024 * 1024 * 1024);
+
+            CHECK_TRUE(split64 > split32);
+            CHECK_TRUE(compact32 < split32);
+            CHECK_TRUE(compact64 < split64);
+        }
+    }
+
+    UNITTEST_FIXTURE(sharded)
+    {
+        UNITTEST_ALLOCATOR;
+
+        static void s_worker(ncore::noffset::sharded_allocator_t* allocator, u32 iterations, bool* ok)
+        {
+            ncore::noffset::allocation_t allocations[64];
+            for (u32 n = 0; n < iterations; ++n)
+            {
+                for (u32 i = 0; i < 64; ++i)
+                {
+                    allocations[i] = allocator->allocate(64 + i * 16);
+                    if (allocations[i].offset == ncore::noffset::allocation_t::NO_SPACE)
+                        *ok = false;
+                }
+                for (u32 i = 0; i < 64; ++i)
+                {
+                    if (allocations[i].offset != ncore::noffset::allocation_t::NO_SPACE)
+                        allocator->free(allocations[i]);
+                }
+            }
+        }
+
+        // Records when two threads are inside the allocator at the same time
+        class overlap_alloc_t : public alloc_t
+        {
+        public:
+            overlap_alloc_t(alloc_t* allocator) : m_allocator(allocator), m_inside(0), m_overlap(false) {}
+
+            alloc_t*         m_allocator;
+            std::atomic<s32> m_inside;
+            bool volatile    m_overlap;
+
+        protected:
+            virtual void* v_allocate(u32 size, u32 alignment)
+            {
+                if (m_inside.fetch_add(1) != 0)
+                    m_overlap = true;
+                std::this_thread::yield();
+                void* ptr = m_allocator->allocate(size, alignment);
+                m_inside.fetch_sub(1);
+                return ptr;
+            }
+            virtual void v_deallocate(void* ptr)
+            {
+                if (m_inside.fetch_add(1) != 0)
+                    m_overlap = true;
+                m_allocator->deallocate(ptr);
+                m_inside.fetch_sub(1);
+            }
+        };
+
+        static void s_grower(ncore::noffset::sharded_allocator_t* allocator, bool* ok)
+        {
+            // Far more live allocations than the initial nodes of a shard
+            ncore::noffset::allocation_t allocations[2048];
+            for (u32 i = 0; i < 2048; ++i)
+            {
+                allocations[i] = allocator->allocate(64);
+                if (allocations[i].offset == ncore::noffset::allocation_t::NO_SPACE)
+                    *ok = false;
+            }
+            for (u32 i = 0; i < 2048; ++i)
+            {
+                if (allocations[i].offset != ncore::noffset::allocation_t::NO_SPACE)
+                    allocator->free(allocations[i]);
+            }
+        }
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(free_routes_to_shard)
+        {
+            ncore::noffset::sharded_allocator_t alloc(Allocator, 4 * 1024 * 1024, 4, 4 * 1024);
+            alloc.setup();
+
+            // The first allocation comes from the start of the home shard
+            const u32                    home = alloc.homeShard();
+            ncore::noffset::allocation_t a    = alloc.allocate(1000);
+            CHECK_EQUAL(home * 1024 * 1024, a.offset);
+            CHECK_EQUAL(home, a.metadata >> ncore::noffset::sharded_allocator_t::SHARD_SHIFT);
+            CHECK_EQUAL((u32)1000, alloc.allocationSize(a));
+
+            alloc.free(a);
+            ncore::noffset::storage_report_t report = alloc.storageReport();
+            CHECK_EQUAL((u32)4 * 1024 * 1024, report.totalFreeSpace);
+            CHECK_EQUAL((u32)1024 * 1024, report.largestFreeRegion);
+
+            alloc.teardown();
+        }
+
+        UNITTEST_TEST(falls_back_to_other_shards)
+        {
+            ncore::noffset::sharded_allocator_t alloc(Allocator, 4 * 1024 * 1024, 4, 4 * 1024);
+            alloc.setup();
+
+            // Every shard holds exactly one 1 MB allocation, the home shard is taken first
+            ncore::noffset::allocation_t allocations[4];
+            for (u32 i = 0; i < 4; ++i)
+            {
+                allocations[i] = alloc.allocate(1024 * 1024);
+                CHECK_NOT_EQUAL(ncore::noffset::allocation_t::NO_SPACE, allocations[i].offset);
+            }
+            CHECK_EQUAL(alloc.homeShard() * 1024 * 1024, allocations[0].offset);
+
+            ncore::noffset::allocation_t none = alloc.allocate(16);
+            CHECK_EQUAL(ncore::noffset::allocation_t::NO_SPACE, none.offset);
+            CHECK_EQUAL(ncore::noffset::allocation_t::NO_NODE, none.metadata);
+            CHECK_EQUAL((u32)0, alloc.allocationSize(none));
+
+            for (u32 i = 0; i < 4; ++i)
+                alloc.free(allocations[i]);
+            CHECK_EQUAL((u32)4 * 1024 * 1024, alloc.storageReport().totalFreeSpace);
+
+            alloc.teardown();
+        }
+
+        UNITTEST_TEST(threads)
+        {
+            ncore::noffset::sharded_allocator_t alloc(Allocator, 64 * 1024 * 1024, 8, 64 * 1024);
+            alloc.setup();
+
+            bool        ok[4] = {true, true, true, true};
+            std::thread threads[4];
+            for (u32 i = 0; i < 4; ++i)
+                threads[i] = std::thread(s_worker, &alloc, 500, &ok[i]);
+            for (u32 i = 0; i < 4; ++i)
+                threads[i].join();
+
+            for (u32 i = 0; i < 4; ++i)
+                CHECK_TRUE(ok[i]);
+            CHECK_EQUAL((u32)64 * 1024 * 1024, alloc.storageReport().totalFreeSpace);
+
+            alloc.teardown();
+        }
+
+        UNITTEST_TEST(threads_grow_shards)
+        {
+            // 32 nodes per shard at the start, every thread makes its home shard grow several times
+            overlap_alloc_t                     backing(Allocator);
+            ncore::noffset::sharded_allocator_t alloc(&backing, 64 * 1024 * 1024, 8, 8 * 32);
+            alloc.setup();
+
+            bool        ok[8] = {true, true, true, true, true, true, true, true};
+            std::thread threads[8];
+            for (u32 i = 0; i < 8; ++i)
+                threads[i] = std::thread(s_grower, &alloc, &ok[i]);
+            for (u32 i = 0; i < 8; ++i)
+                threads[i].join();
+
+            for (u32 i = 0; i < 8; ++i)
+                CHECK_TRUE(ok[i]);
+            CHECK_FALSE(backing.m_overlap);
+            CHECK_EQUAL((u32)64 * 1024 * 1024, alloc.storageReport().totalFreeSpace);
+
+            alloc.teardown();
+        }
+    }
 }
 UNITTEST_SUITE_END
@@ -0,0 +1,144 @@
+#include "ccore/c_allocator.h"
+#include "callocator/c_allocator_offset.h"
+#include "cunittest/cunittest.h"
+
+using namespace ncore;
+
+UNITTEST_SUITE_BEGIN(offset_compact)
+{
+    UNITTEST_FIXTURE(allocator)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(reuse_and_merge)
+        {
+            ncore::noffset::allocator_compact_t alloc(Allocator, 1024 * 1024 * 256);
+            alloc.setup();
+
+            ncore::noffset::allocation_t a = alloc.allocate(1024);
+            ncore::noffset::allocation_t b = alloc.allocate(3456);
+            ncore::noffset::allocation_t c = alloc.allocate(1024);
+            CHECK_EQUAL((u32)0, a.offset);
+            CHECK_EQUAL((u32)1024, b.offset);
+            CHECK_EQUAL((u32)4480, c.offset);
+            CHECK_EQUAL((u32)3456, alloc.allocationSize(b));
+
+            // Free node offset and size come from the used neighbors
+            alloc.free(b);
+            ncore::noffset::allocation_t d = alloc.allocate(2345);
+            CHECK_EQUAL((u32)1024, d.offset);
+
+            alloc.free(a);
+            alloc.free(c);
+            alloc.free(d);
+
+            // End: Validate that allocator has no fragmentation left. Should be 100% clean.
+            ncore::noffset::allocation_t validateAll = alloc.allocate(1024 * 1024 * 256);
+            CHECK_EQUAL((u32)0, validateAll.offset);
+            alloc.free(validateAll);
+
+            alloc.teardown();
+        }
+
+        UNITTEST_TEST(aligned_and_growing)
+        {
+            ncore::noffset::allocator_compact_t alloc(Allocator, 1024 * 1024 * 16, 0, 32);
+            alloc.setup();
+
+            const u32                     count       = 3000;
+            ncore::noffset::allocation_t* allocations = g_allocate_array<ncore::noffset::allocation_t>(Allocator, count);
+            for (u32 i = 0; i < count; i++)
+            {
+                const u32 alignment = (u32)1 << (i & 7);
+                allocations[i]      = alloc.allocate(100 + (i & 15), alignment);
+                CHECK_NOT_EQUAL(ncore::noffset::allocation_t::NO_SPACE, allocations[i].offset);
+                CHECK_EQUAL((u32)0, allocations[i].offset & (alignment - 1));
+            }
+            for (u32 i = 0; i < count; i++)
+                CHECK_EQUAL(100 + (i & 15), alloc.allocationSize(allocations[i]));
+            for (u32 i = 0; i < count; i += 2)
+                alloc.free(allocations[i]);
+            for (u32 i = 1; i < count; i += 2)
+                alloc.free(allocations[i]);
+
+            ncore::noffset::storage_report_t report = alloc.storageReport();
+            CHECK_EQUAL((u32)1024 * 1024 * 16, report.totalFreeSpace);
+            CHECK_EQUAL((u32)1024 * 1024 * 16, report.largestFreeRegion);
+
+            Allocator->deallocate(allocations);
+            alloc.teardown();
+        }
+
+        UNITTEST_TEST(deferred_and_defrag)
+        {
+            ncore::noffset::allocator_compact_t alloc(Allocator, 1024 * 1024);
+            alloc.setup();
+
+            ncore::noffset::allocation_t x = alloc.allocate(1000);
+            ncore::noffset::allocation_t y = alloc.allocate(1000);
+            ncore::noffset::allocation_t z = alloc.allocate(1000);
+            ncore::noffset::allocation_t w = alloc.allocate(1000);
+            ncore::noffset::allocation_t v = alloc.allocate(1000);
+            alloc.free(x);
+            CHECK_TRUE(alloc.free(y, 5));
+            alloc.free(w);
+
+            // Nothing slides across the pending 'y', 'v' moves into the space of 'w' (8 byte aligned)
+            ncore::noffset::defrag_move_t moves[4];
+            const u32                     count = alloc.planDefrag(moves, 4, 1024 * 1024, 8);
+            CHECK_EQUAL((u32)1, count);
+            CHECK_EQUAL(v.metadata, moves[0].metadata);
+            CHECK_EQUAL((u32)3000, moves[0].to);
+            alloc.commitDefrag(moves, count);
+            CHECK_EQUAL((u32)1000, alloc.allocationSize(v));
+
+            CHECK_EQUAL((u32)1, alloc.retire(5));
+            alloc.free(z);
+            alloc.free(v);
+            ncore::noffset::allocation_t validateAll = alloc.allocate(1024 * 1024);
+            CHECK_EQUAL((u32)0, validateAll.offset);
+            alloc.free(validateAll);
+
+            alloc.teardown();
+        }
+
+        UNITTEST_TEST(save_and_load)
+        {
+            ncore::noffset::allocator64_compact_t alloc(Allocator, (u64)8 * 1024 * 1024 * 1024, 0, 32);
+            alloc.setup();
+
+            ncore::noffset::allocation64_t allocations[100];
+            for (u32 i = 0; i < 100; i++)
+                allocations[i] = alloc.allocate((u64)1024 * 1024 * (i + 1), (i & 1) ? 4096 : 1);
+            for (u32 i = 0; i < 100; i += 3)
+                alloc.free(allocations[i]);
+
+            const u64 size = alloc.saveSize();
+            void*     blob = Allocator->allocate((u32)size);
+            CHECK_EQUAL(size, alloc.save(blob, size));
+
+            // The blob only loads with the same node layout
+            ncore::noffset::allocator64_t split(Allocator, (u64)8 * 1024 * 1024 * 1024, 0, 32);
+            CHECK_FALSE(split.load(blob, size));
+
+            ncore::noffset::allocator64_compact_t restored(Allocator, (u64)8 * 1024 * 1024 * 1024, 0, 32);
+            CHECK_TRUE(restored.load(blob, size));
+            Allocator->deallocate(blob);
+            CHECK_EQUAL(alloc.storageReport().totalFreeSpace, restored.storageReport().totalFreeSpace);
+
+            for (u32 i = 0; i < 100; i++)
+            {
+                if ((i % 3) != 0)
+                    restored.free(allocations[i]);
+            }
+            CHECK_EQUAL((u64)8 * 1024 * 1024 * 1024, restored.storageReport().totalFreeSpace);
+
+            restored.teardown();
+            alloc.teardown();
+        }
+    }
+}
+UNITTEST_SUITE_END